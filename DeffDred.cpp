@@ -8,20 +8,104 @@
 #include <thread>
 #include <stdexcept>
 #include <algorithm>
-#include <set>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 #include <random>
 #include <limits>
+#include <cstdio>
+#include <cstdlib>
+#include <csignal>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <deque>
+#include <functional>
+#include <type_traits>
+#include <new>
 #ifdef _WIN32
 #include <conio.h>
 #include <windows.h>
+#include <intrin.h>
 #else
 #include <termios.h>
 #include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DEFFDRED_X86 1
+#include <immintrin.h>
+#else
+#define DEFFDRED_X86 0
+#endif
+#if defined(_MSC_VER)
+#define DEFFDRED_TARGET(isa)
+#else
+#define DEFFDRED_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+//with DEFFDRED_COUNT_ALLOCS=1 every operator new on any thread is counted, the profiler reports
+//allocations per frame and --check-alloc fails on any made by a steady state frame
+#ifndef DEFFDRED_COUNT_ALLOCS
+#define DEFFDRED_COUNT_ALLOCS 0
+#endif
+#if DEFFDRED_COUNT_ALLOCS
+static std::atomic<unsigned long long> g_allocCount{ 0 }, g_allocBytes{ 0 };
+
+void* operator new(size_t size) {
+    g_allocCount.fetch_add(1, std::memory_order_relaxed);
+    g_allocBytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+//kept out of line so the compiler never pairs an inlined free with a builtin new
+#if defined(_MSC_VER)
+__declspec(noinline)
+#else
+__attribute__((noinline))
+#endif
+static void ReleaseAllocation(void* p) noexcept { std::free(p); }
+void operator delete(void* p) noexcept { ReleaseAllocation(p); }
+void operator delete(void* p, size_t) noexcept { ReleaseAllocation(p); }
 #endif
 
+//the classic arena, and the viewport the terminal shows of a bigger one
 constexpr int GRID_ROWS = 20;
 constexpr int GRID_COLS = 60;
 constexpr int FRAME_MS = 60;
+//bullet positions are int16 lanes, so arenas stop well short of where a fast bullet could wrap
+constexpr int MAX_ARENA_SIDE = 16384;
+
+//the arena size is a world parameter; ClassicArena is the shipped size as compile time constants
+//and hot loops are templates over the two, so the classic game folds every bound as it always did
+struct ClassicArena {
+    static constexpr int rows = GRID_ROWS;
+    static constexpr int cols = GRID_COLS;
+};
+constexpr int ClassicArena::rows;
+constexpr int ClassicArena::cols;
+
+struct Arena {
+    int rows = GRID_ROWS;
+    int cols = GRID_COLS;
+    bool classic() const { return rows == GRID_ROWS && cols == GRID_COLS; }
+    //at least the classic size, so the view always fits inside
+    bool valid() const {
+        return rows >= GRID_ROWS && cols >= GRID_COLS && rows <= MAX_ARENA_SIDE && cols <= MAX_ARENA_SIDE;
+    }
+};
+
+template <typename A>
+static bool InArena(const A& arena, int x, int y) {
+    return x >= 0 && x < arena.cols && y >= 0 && y < arena.rows;
+}
+//64 bit words per row of an arena bitset
+template <typename A>
+static int RowWords(const A& arena) { return (arena.cols + 63) / 64; }
 
 enum class UpgradeType {
     IncreaseHP,
@@ -46,19 +130,495 @@ static const char* GetUpgradeName(UpgradeType upg) {
     }
 }
 
-class Bullet {
+//held keys for one frame
+enum KeyBit : unsigned char {
+    KeyUp = 1 << 0,
+    KeyLeft = 1 << 1,
+    KeyDown = 1 << 2,
+    KeyRight = 1 << 3,
+    KeyQuit = 1 << 4,
+    KeyFire = 1 << 5,
+    KeyRewind = 1 << 6
+};
+typedef unsigned char KeyMask;
+
+static KeyMask KeyBitFor(char ch) {
+    switch (ch) {
+    case 'w': return KeyUp;
+    case 'a': return KeyLeft;
+    case 's': return KeyDown;
+    case 'd': return KeyRight;
+    case 'q': return KeyQuit;
+    case ' ': return KeyFire;
+    case 'r': return KeyRewind;
+    default:  return 0;
+    }
+}
+
+enum class BulletOwner : unsigned char { Enemy, Player };
+
+//the columns of a BulletPool a step kernel works on, compacted in place
+struct BulletLanes {
+    int16_t* x;
+    int16_t* y;
+    int16_t* dx;
+    int16_t* dy;
+    char* symbol;
+    unsigned char* owner;
+    size_t n;
+    int16_t rows, cols; //arena the bullets are kept in
+};
+
+//moves every bullet one step and keeps, in order, those that ended the step in the arena, from index i
+//on with w survivors already packed; positions wrap at 16 bits exactly like the vector lanes do.
+//a fast bullet (more than one cell a step) that just left stays one more frame so the collision pass
+//can sweep the part of its last step that was inside
+template <typename A>
+static size_t StepBulletsScalarFrom(const BulletLanes& b, size_t i, size_t w, const A& arena) {
+    for (; i < b.n; ++i) {
+        const int16_t nx = static_cast<int16_t>(b.x[i] + b.dx[i]);
+        const int16_t ny = static_cast<int16_t>(b.y[i] + b.dy[i]);
+        const bool fast = b.dx[i] > 1 || b.dx[i] < -1 || b.dy[i] > 1 || b.dy[i] < -1;
+        if (!InArena(arena, nx, ny) && !(fast && InArena(arena, b.x[i], b.y[i]))) continue;
+        b.x[w] = nx;
+        b.y[w] = ny;
+        b.dx[w] = b.dx[i];
+        b.dy[w] = b.dy[i];
+        b.symbol[w] = b.symbol[i];
+        b.owner[w] = b.owner[i];
+        ++w;
+    }
+    return w;
+}
+
+static size_t StepBulletsScalarFrom(const BulletLanes& b, size_t i, size_t w) {
+    if (b.rows == GRID_ROWS && b.cols == GRID_COLS) return StepBulletsScalarFrom(b, i, w, ClassicArena());
+    return StepBulletsScalarFrom(b, i, w, Arena{ b.rows, b.cols });
+}
+
+static size_t StepBulletsScalar(const BulletLanes& b) { return StepBulletsScalarFrom(b, 0, 0); }
+
+#if DEFFDRED_X86
+//pshufb controls that move the lanes set in an 8 bit keep mask to the front, for 16 bit and 8 bit lanes
+struct PackTables {
+    alignas(16) unsigned char words[256][16];
+    alignas(16) unsigned char bytes[256][16];
+    unsigned char count[256];
+    PackTables() {
+        std::memset(words, 0x80, sizeof(words));
+        std::memset(bytes, 0x80, sizeof(bytes));
+        for (int m = 0; m < 256; ++m) {
+            int k = 0;
+            for (int lane = 0; lane < 8; ++lane) {
+                if (!((m >> lane) & 1)) continue;
+                words[m][2 * k] = static_cast<unsigned char>(2 * lane);
+                words[m][2 * k + 1] = static_cast<unsigned char>(2 * lane + 1);
+                bytes[m][k] = static_cast<unsigned char>(lane);
+                ++k;
+            }
+            count[m] = static_cast<unsigned char>(k);
+        }
+    }
+};
+
+static const PackTables& GetPackTables() {
+    static const PackTables tables;
+    return tables;
+}
+
+//stores the kept lanes of one 8 bullet block at w; the block was read from i >= w so the
+//full width stores only ever clobber lanes that are already loaded
+DEFFDRED_TARGET("ssse3")
+static inline size_t PackBlock(const BulletLanes& b, const PackTables& t, int keep, size_t i, size_t w,
+                               __m128i vx, __m128i vy, __m128i vdx, __m128i vdy) {
+    const __m128i words = _mm_load_si128(reinterpret_cast<const __m128i*>(t.words[keep]));
+    const __m128i bytes = _mm_load_si128(reinterpret_cast<const __m128i*>(t.bytes[keep]));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(b.x + w), _mm_shuffle_epi8(vx, words));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(b.y + w), _mm_shuffle_epi8(vy, words));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(b.dx + w), _mm_shuffle_epi8(vdx, words));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(b.dy + w), _mm_shuffle_epi8(vdy, words));
+    const __m128i sym = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b.symbol + i));
+    const __m128i own = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(b.owner + i));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(b.symbol + w), _mm_shuffle_epi8(sym, bytes));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(b.owner + w), _mm_shuffle_epi8(own, bytes));
+    return w + t.count[keep];
+}
+
+DEFFDRED_TARGET("ssse3")
+static size_t StepBulletsSsse3(const BulletLanes& b) {
+    const PackTables& t = GetPackTables();
+    const __m128i cols = _mm_set1_epi16(b.cols), rows = _mm_set1_epi16(b.rows), minus1 = _mm_set1_epi16(-1);
+    const __m128i one = _mm_set1_epi16(1);
+    size_t i = 0, w = 0;
+    for (; i + 8 <= b.n; i += 8) {
+        const __m128i vdx = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b.dx + i));
+        const __m128i vdy = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b.dy + i));
+        const __m128i ox = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b.x + i));
+        const __m128i oy = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b.y + i));
+        const __m128i vx = _mm_add_epi16(ox, vdx);
+        const __m128i vy = _mm_add_epi16(oy, vdy);
+        const __m128i inside = _mm_and_si128(
+            _mm_and_si128(_mm_cmpgt_epi16(vx, minus1), _mm_cmpgt_epi16(cols, vx)),
+            _mm_and_si128(_mm_cmpgt_epi16(vy, minus1), _mm_cmpgt_epi16(rows, vy)));
+        const __m128i wasInside = _mm_and_si128(
+            _mm_and_si128(_mm_cmpgt_epi16(ox, minus1), _mm_cmpgt_epi16(cols, ox)),
+            _mm_and_si128(_mm_cmpgt_epi16(oy, minus1), _mm_cmpgt_epi16(rows, oy)));
+        const __m128i fast = _mm_or_si128(
+            _mm_or_si128(_mm_cmpgt_epi16(vdx, one), _mm_cmpgt_epi16(minus1, vdx)),
+            _mm_or_si128(_mm_cmpgt_epi16(vdy, one), _mm_cmpgt_epi16(minus1, vdy)));
+        const __m128i kept = _mm_or_si128(inside, _mm_and_si128(wasInside, fast));
+        const int keep = _mm_movemask_epi8(_mm_packs_epi16(kept, _mm_setzero_si128()));
+        w = PackBlock(b, t, keep, i, w, vx, vy, vdx, vdy);
+    }
+    return StepBulletsScalarFrom(b, i, w);
+}
+
+//16 bullets a block, the arithmetic and bounds in 256 bit lanes and the compaction as two 8 lane halves
+DEFFDRED_TARGET("avx2")
+static size_t StepBulletsAvx2(const BulletLanes& b) {
+    const PackTables& t = GetPackTables();
+    const __m256i cols = _mm256_set1_epi16(b.cols), rows = _mm256_set1_epi16(b.rows), minus1 = _mm256_set1_epi16(-1);
+    const __m256i one = _mm256_set1_epi16(1);
+    size_t i = 0, w = 0;
+    for (; i + 16 <= b.n; i += 16) {
+        const __m256i vdx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b.dx + i));
+        const __m256i vdy = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b.dy + i));
+        const __m256i ox = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b.x + i));
+        const __m256i oy = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b.y + i));
+        const __m256i vx = _mm256_add_epi16(ox, vdx);
+        const __m256i vy = _mm256_add_epi16(oy, vdy);
+        const __m256i inside = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpgt_epi16(vx, minus1), _mm256_cmpgt_epi16(cols, vx)),
+            _mm256_and_si256(_mm256_cmpgt_epi16(vy, minus1), _mm256_cmpgt_epi16(rows, vy)));
+        const __m256i wasInside = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpgt_epi16(ox, minus1), _mm256_cmpgt_epi16(cols, ox)),
+            _mm256_and_si256(_mm256_cmpgt_epi16(oy, minus1), _mm256_cmpgt_epi16(rows, oy)));
+        const __m256i fast = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpgt_epi16(vdx, one), _mm256_cmpgt_epi16(minus1, vdx)),
+            _mm256_or_si256(_mm256_cmpgt_epi16(vdy, one), _mm256_cmpgt_epi16(minus1, vdy)));
+        const __m256i kept = _mm256_or_si256(inside, _mm256_and_si256(wasInside, fast));
+        const int keep = _mm_movemask_epi8(_mm_packs_epi16(_mm256_castsi256_si128(kept), _mm256_extracti128_si256(kept, 1)));
+        w = PackBlock(b, t, keep & 0xFF, i, w, _mm256_castsi256_si128(vx), _mm256_castsi256_si128(vy),
+            _mm256_castsi256_si128(vdx), _mm256_castsi256_si128(vdy));
+        w = PackBlock(b, t, keep >> 8, i + 8, w, _mm256_extracti128_si256(vx, 1), _mm256_extracti128_si256(vy, 1),
+            _mm256_extracti128_si256(vdx, 1), _mm256_extracti128_si256(vdy, 1));
+    }
+    return StepBulletsScalarFrom(b, i, w);
+}
+#endif
+
+enum class SimdLevel { Scalar, Ssse3, Avx2 };
+
+static const char* GetSimdName(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::Ssse3: return "ssse3";
+    case SimdLevel::Avx2:  return "avx2";
+    default:               return "scalar";
+    }
+}
+
+static SimdLevel DetectSimd() {
+#if DEFFDRED_X86 && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    __cpuid(info, 1);
+    const bool ssse3 = (info[2] & (1 << 9)) != 0;
+    const bool osAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    if (osAvx && maxLeaf >= 7) {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5)) return SimdLevel::Avx2;
+    }
+    if (ssse3) return SimdLevel::Ssse3;
+#elif DEFFDRED_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::Avx2;
+    if (__builtin_cpu_supports("ssse3")) return SimdLevel::Ssse3;
+#endif
+    return SimdLevel::Scalar;
+}
+
+typedef size_t (*BulletStepFn)(const BulletLanes&);
+
+//the kernel for level, nullptr when this cpu or build lacks it
+static BulletStepFn GetBulletStep(SimdLevel level) {
+    static const SimdLevel supported = DetectSimd();
+    if (level > supported) return nullptr;
+    switch (level) {
+#if DEFFDRED_X86
+    case SimdLevel::Ssse3: return StepBulletsSsse3;
+    case SimdLevel::Avx2:  return StepBulletsAvx2;
+#endif
+    case SimdLevel::Scalar: return StepBulletsScalar;
+    default:                return nullptr;
+    }
+}
+
+//the widest kernel this cpu runs, chosen once
+static BulletStepFn BestBulletStep() {
+    static const BulletStepFn best = [] {
+        for (SimdLevel level : { SimdLevel::Avx2, SimdLevel::Ssse3 }) {
+            if (BulletStepFn fn = GetBulletStep(level)) return fn;
+        }
+        return GetBulletStep(SimdLevel::Scalar);
+    }();
+    return best;
+}
+
+//bullets as packed int16 columns so the step kernel moves 8 or 16 of them per instruction
+class BulletPool {
+public:
+    std::vector<int16_t> x, y, dx, dy;
+    std::vector<char> symbol;
+    std::vector<BulletOwner> owner;
+
+    BulletPool() { reserve(4096); }
+    template <typename Archive>
+    void transfer(Archive& a) {
+        a.array(x); a.array(y); a.array(dx); a.array(dy); a.array(symbol); a.array(owner);
+    }
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+    void reserve(size_t n) {
+        x.reserve(n); y.reserve(n); dx.reserve(n); dy.reserve(n);
+        symbol.reserve(n); owner.reserve(n);
+    }
+    void spawn(int x_, int y_, int dx_, int dy_, char symbol_ = '*', BulletOwner owner_ = BulletOwner::Enemy) {
+        x.push_back(Lane(x_)); y.push_back(Lane(y_)); dx.push_back(Lane(dx_)); dy.push_back(Lane(dy_));
+        symbol.push_back(symbol_); owner.push_back(owner_);
+    }
+    void remove(size_t i) {
+        const size_t last = size() - 1;
+        if (i != last) {
+            x[i] = x[last]; y[i] = y[last]; dx[i] = dx[last]; dy[i] = dy[last];
+            symbol[i] = symbol[last]; owner[i] = owner[last];
+        }
+        x.pop_back(); y.pop_back(); dx.pop_back(); dy.pop_back();
+        symbol.pop_back(); owner.pop_back();
+    }
+    void clear() {
+        x.clear(); y.clear(); dx.clear(); dy.clear();
+        symbol.clear(); owner.clear();
+    }
+    //advances every bullet and drops those that were already outside, survivors keep their order
+    void step(BulletStepFn kernel = BestBulletStep(), const Arena& arena = Arena()) {
+        static_assert(sizeof(BulletOwner) == 1, "owner lanes are bytes");
+        BulletLanes lanes{ x.data(), y.data(), dx.data(), dy.data(), symbol.data(),
+                           reinterpret_cast<unsigned char*>(owner.data()), size(),
+                           static_cast<int16_t>(arena.rows), static_cast<int16_t>(arena.cols) };
+        resize(kernel(lanes));
+    }
+
+    //more than one cell this frame, so the end point alone could have jumped over something
+    bool isFast(size_t i) const { return std::abs(dx[i]) > 1 || std::abs(dy[i]) > 1; }
+
+    //walks the cells bullet i crossed in its last step, after the one it left and ending on the one it
+    //reached, stepping diagonally only through exact corners; returns true as soon as visit(x, y) does
+    template <typename Visit>
+    bool sweep(size_t i, Visit visit) const { return SweepStep(x[i] - dx[i], y[i] - dy[i], dx[i], dy[i], visit); }
+
+    //the same walk for a step of (stepX, stepY) from (fromX, fromY)
+    template <typename Visit>
+    static bool SweepStep(int fromX, int fromY, int stepX, int stepY, Visit visit) {
+        const int nx = std::abs(stepX), ny = std::abs(stepY);
+        const int sx = stepX < 0 ? -1 : 1, sy = stepY < 0 ? -1 : 1;
+        int cx = fromX, cy = fromY;
+        for (int ix = 0, iy = 0; ix < nx || iy < ny;) {
+            const long long decision = static_cast<long long>(1 + 2 * ix) * ny - static_cast<long long>(1 + 2 * iy) * nx;
+            if (decision == 0) {
+                cx += sx; cy += sy; ++ix; ++iy;
+            } else if (decision < 0) {
+                cx += sx; ++ix;
+            } else {
+                cy += sy; ++iy;
+            }
+            if (visit(cx, cy)) return true;
+        }
+        return false;
+    }
+
+private:
+    static int16_t Lane(int v) {
+        return static_cast<int16_t>(std::max<int>(std::numeric_limits<int16_t>::min(),
+            std::min<int>(std::numeric_limits<int16_t>::max(), v)));
+    }
+    void resize(size_t n) {
+        x.resize(n); y.resize(n); dx.resize(n); dy.resize(n);
+        symbol.resize(n); owner.resize(n);
+    }
+};
+
+static int LowestBit(uint64_t v) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, v);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+//a sprite as one bitmask per row, bit sx set where the shape has a non space character
+struct ShapeMask {
+    int originX = 0, originY = 0; //offset of bit 0 / row 0 from the entity position
+    std::vector<uint64_t> rows;
+
+    static ShapeMask compile(const std::vector<std::string>& shape) {
+        ShapeMask m;
+        for (const std::string& row : shape) {
+            if (row.size() > 62) throw std::runtime_error("Shape wider than 62 cells"); //room to dilate
+            uint64_t bits = 0;
+            for (size_t sx = 0; sx < row.size(); ++sx) {
+                if (row[sx] != ' ') bits |= uint64_t(1) << sx;
+            }
+            m.rows.push_back(bits);
+        }
+        return m;
+    }
+    //the shape grown by one cell up, down, left and right
+    ShapeMask dilated() const {
+        ShapeMask m;
+        m.originX = originX - 1;
+        m.originY = originY - 1;
+        m.rows.assign(rows.size() + 2, 0);
+        for (size_t r = 0; r < rows.size(); ++r) {
+            const uint64_t bits = rows[r] << 1;
+            m.rows[r] |= bits;
+            m.rows[r + 1] |= bits | (bits << 1) | (bits >> 1);
+            m.rows[r + 2] |= bits;
+        }
+        return m;
+    }
+    bool covers(int dx, int dy) const {
+        dx -= originX;
+        dy -= originY;
+        if (dy < 0 || dy >= static_cast<int>(rows.size()) || dx < 0 || dx >= 64) return false;
+        return (rows[dy] >> dx) & 1;
+    }
+    //calls fn(x, y) for every covered arena cell with the shape at (x, y)
+    template <typename A, typename Fn>
+    void forEachCell(const A& arena, int x, int y, Fn fn) const {
+        for (int r = 0; r < static_cast<int>(rows.size()); ++r) {
+            const int cy = y + originY + r;
+            if (cy < 0 || cy >= arena.rows) continue;
+            for (uint64_t bits = rows[r]; bits; bits &= bits - 1) {
+                const int cx = x + originX + LowestBit(bits);
+                if (cx >= 0 && cx < arena.cols) fn(cx, cy);
+            }
+        }
+    }
+};
+
+//one bit per arena cell, row y from word y * words on; bits past the last column are never set.
+//the per cell calls take the arena so the classic size indexes with constants
+class ArenaBits {
+    int rows = 0, words = 0;
+    std::vector<uint64_t> bits;
+    //past this many words, the rows set since the last clear and the span of words set in each are
+    //tracked, so clearing and intersecting cost what was set and not the arena; lastWord is -1 on a
+    //clean row. smaller sets are cheaper to sweep whole than to track
+    static constexpr size_t TRACKED_WORDS = 1024;
+    bool tracked = false;
+    std::vector<int> dirtyRows, firstWord, lastWord;
+
+    void touch(int y, int w0, int w1) {
+        if (!tracked) return;
+        if (lastWord[y] < 0) {
+            dirtyRows.push_back(y);
+            firstWord[y] = w0;
+            lastWord[y] = w1;
+            return;
+        }
+        firstWord[y] = std::min(firstWord[y], w0);
+        lastWord[y] = std::max(lastWord[y], w1);
+    }
+
+    //whether shape row bits with bit 0 on column x meet a set cell of row y
+    bool rowOverlaps(int y, uint64_t shape, int x) const {
+        if (x < 0) {
+            if (x <= -64) return false;
+            shape >>= -x;
+            x = 0;
+        }
+        const uint64_t* row = &bits[static_cast<size_t>(y) * words];
+        const int word = x >> 6, shift = x & 63;
+        if (word < words && (row[word] & (shape << shift))) return true;
+        return shift && word + 1 < words && (row[word + 1] & (shape >> (64 - shift)));
+    }
+
 public:
-    int x, y, dx, dy;
-    char symbol;
-    Bullet(int x_, int y_, int dx_, int dy_, char symbol_ = '*')
-        : x(x_), y(y_), dx(dx_), dy(dy_), symbol(symbol_) {
+    explicit ArenaBits(const Arena& arena)
+        : rows(arena.rows), words(RowWords(arena)), bits(static_cast<size_t>(rows) * words),
+          firstWord(rows, 0), lastWord(rows, -1) {
+        tracked = bits.size() > TRACKED_WORDS;
+        dirtyRows.reserve(rows);
+    }
+
+    void clear() {
+        if (!tracked) {
+            std::fill(bits.begin(), bits.end(), 0);
+            return;
+        }
+        for (int y : dirtyRows) {
+            uint64_t* row = &bits[static_cast<size_t>(y) * words];
+            std::fill(row + firstWord[y], row + lastWord[y] + 1, 0);
+            lastWord[y] = -1;
+        }
+        dirtyRows.clear();
+    }
+    template <typename A>
+    void set(const A& arena, int x, int y) {
+        if (!InArena(arena, x, y)) return;
+        bits[static_cast<size_t>(y) * RowWords(arena) + (x >> 6)] |= uint64_t(1) << (x & 63);
+        touch(y, x >> 6, x >> 6);
+    }
+    template <typename A>
+    void reset(const A& arena, int x, int y) {
+        if (InArena(arena, x, y)) bits[static_cast<size_t>(y) * RowWords(arena) + (x >> 6)] &= ~(uint64_t(1) << (x & 63));
+    }
+    template <typename A>
+    bool test(const A& arena, int x, int y) const {
+        return InArena(arena, x, y) && (bits[static_cast<size_t>(y) * RowWords(arena) + (x >> 6)] >> (x & 63)) & 1;
+    }
+    //columns x0..x1 inclusive of row y, clipped to the arena
+    template <typename A>
+    void setSpan(const A& arena, int y, int x0, int x1) {
+        x0 = std::max(x0, 0);
+        x1 = std::min(x1, arena.cols - 1);
+        if (y < 0 || y >= arena.rows || x0 > x1) return;
+        uint64_t* row = &bits[static_cast<size_t>(y) * RowWords(arena)];
+        for (int w = x0 >> 6; w <= x1 >> 6; ++w) {
+            const int lo = std::max(x0 - w * 64, 0), hi = std::min(x1 - w * 64, 63);
+            row[w] |= (~uint64_t(0) >> (63 - (hi - lo))) << lo;
+        }
+        touch(y, x0 >> 6, x1 >> 6);
+    }
+    //walks only the words this set has set, so call it on the sparser of the two
+    bool intersects(const ArenaBits& o) const {
+        if (!tracked) {
+            for (size_t i = 0; i < bits.size(); ++i) if (bits[i] & o.bits[i]) return true;
+            return false;
+        }
+        for (int y : dirtyRows) {
+            const size_t row = static_cast<size_t>(y) * words;
+            for (int w = firstWord[y]; w <= lastWord[y]; ++w)
+                if (bits[row + w] & o.bits[row + w]) return true;
+        }
+        return false;
     }
-    void update() { x += dx; y += dy; }
-    bool isOutOfBounds() const {
-        return x < 0 || x >= GRID_COLS || y < 0 || y >= GRID_ROWS;
+    //true when the shape at (x, y) covers a set cell
+    bool overlaps(const ShapeMask& m, int x, int y) const {
+        for (int r = 0; r < static_cast<int>(m.rows.size()); ++r) {
+            const int cy = y + m.originY + r;
+            if (cy < 0 || cy >= rows || !m.rows[r]) continue;
+            if (rowOverlaps(cy, m.rows[r], x + m.originX)) return true;
+        }
+        return false;
     }
 };
 
+constexpr size_t ArenaBits::TRACKED_WORDS;
+
 class Player {
 public:
     int x, y;
@@ -72,643 +632,3832 @@ public:
     int moveSpeed = 1;
     int bulletStreams = 1; //number of active streams (1-8)
     int lifeStealPercent = 0;
-    const std::vector<std::string> shape = { " A ","/V\\" };
+    static const std::vector<std::string> shape;
     Player(int x_, int y_) : x(x_), y(y_) {}
-    void move(const std::set<char>& inputs) {
-        if (inputs.count('w') && y > 0) y -= moveSpeed;
-        if (inputs.count('s') && y < GRID_ROWS - 2) y += moveSpeed;
-        if (inputs.count('a') && x > 0) x -= moveSpeed;
-        if (inputs.count('d') && x < GRID_COLS - 3) x += moveSpeed;
+    template <typename A>
+    void move(KeyMask keys, const A& arena) {
+        if ((keys & KeyUp) && y > 0) y -= moveSpeed;
+        if ((keys & KeyDown) && y < arena.rows - 2) y += moveSpeed;
+        if ((keys & KeyLeft) && x > 0) x -= moveSpeed;
+        if ((keys & KeyRight) && x < arena.cols - 3) x += moveSpeed;
         if (x < 0) x = 0;
-        if (x > GRID_COLS - 3) x = GRID_COLS - 3;
+        if (x > arena.cols - 3) x = arena.cols - 3;
         if (y < 0) y = 0;
-        if (y > GRID_ROWS - 2) y = GRID_ROWS - 2;
-    }
-    bool collides(const Bullet& b) const {
-        for (int dy = 0; dy < shape.size(); ++dy) {
-            for (int dx = 0; dx < shape[dy].size(); ++dx) {
-                if (shape[dy][dx] != ' ' &&
-                    b.x == x + dx && b.y == y + dy)
-                    return true;
-            }
-        }
-        return false;
+        if (y > arena.rows - 2) y = arena.rows - 2;
     }
+    static const ShapeMask mask;
+    bool collides(int bx, int by) const { return mask.covers(bx - x, by - y); }
 };
 
+const std::vector<std::string> Player::shape = { " A ","/V\\" };
+const ShapeMask Player::mask = ShapeMask::compile(Player::shape);
+
 struct BulletSpawn {
     int time, x, y, dx, dy;
 };
 
+//count bullets angleStep degrees apart, emitted every period frames repeats times from time on;
+//angles are screen degrees (0 right, 90 down), spin turns each emission and aimed emitters centre on the player
+struct Emitter {
+    int time = 0;
+    int x = 0, y = 0;
+    int count = 1;
+    float angleStep = 0;
+    int period = 1;
+    int repeats = 1;
+    bool aim = false;
+    int speed = 1;
+    float angle = 0;
+    float spin = 0;
+    char symbol = '*';
+};
+
+static uint32_t Fnv1a(const unsigned char* data, size_t size, uint32_t hash = 2166136261u) {
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+//read only view of a whole file, unmapped on destruction
+class MappedFile {
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE mapping = nullptr;
+#endif
+public:
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            CloseHandle(file);
+            return false;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (!mapping) return false;
+        bytes = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (!bytes) {
+            CloseHandle(mapping);
+            mapping = nullptr;
+            return false;
+        }
+        length = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        bytes = static_cast<const unsigned char*>(p);
+        length = static_cast<size_t>(st.st_size);
+#endif
+        return true;
+    }
+    void close() {
+        if (!bytes) return;
+#ifdef _WIN32
+        UnmapViewOfFile(bytes);
+        CloseHandle(mapping);
+        mapping = nullptr;
+#else
+        munmap(const_cast<unsigned char*>(bytes), length);
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+//binary pattern: this header followed by recordCount time sorted fixed width records, either
+//{int32 time; int16 x, y, dx, dy} or, with PATTERN_DELTA_TIMES, {uint16 frames since previous; int16 x, y, dx, dy},
+//then (version 2) emitterCount EmitterRecords
+struct PatternFileHeader {
+    char magic[4];
+    uint16_t version;
+    uint16_t flags;
+    uint32_t recordCount;
+    uint32_t recordSize;
+    uint32_t checksum; //FNV-1a of all record and emitter bytes
+    uint32_t emitterCount;
+    uint32_t reserved[2];
+};
+static_assert(sizeof(PatternFileHeader) == 32, "pattern header layout");
+
+struct EmitterRecord {
+    int32_t time;
+    int16_t x, y, count, period, repeats, speed;
+    float angleStep, angle, spin;
+    uint8_t aim;
+    char symbol;
+    uint8_t pad[2];
+};
+static_assert(sizeof(EmitterRecord) == 32, "emitter record layout");
+
+static const char PATTERN_MAGIC[4] = { 'D', 'D', 'P', 'T' };
+constexpr uint16_t PATTERN_VERSION = 2;
+constexpr uint16_t PATTERN_DELTA_TIMES = 1;
+
 class BulletManager {
+    friend class FrameBench;
     std::vector<BulletSpawn> spawns;
     size_t nextSpawn = 0;
-public:
-    void loadPattern(const std::string& filename) {
+    //binary patterns are read straight out of the mapping
+    MappedFile mapped;
+    const unsigned char* records = nullptr;
+    size_t recordCount = 0;
+    size_t recordSize = 0;
+    bool deltaTimes = false;
+    int lastTime = 0;
+    std::string error;
+    Arena arena; //emitters placed outside it stay silent
+    //emitters sorted by start time, those already started are expanded as each emission falls due
+    struct ActiveEmitter {
+        size_t index;
+        int nextTime;
+        int fired;
+    };
+    std::vector<Emitter> emitters;
+    size_t nextEmitter = 0;
+    std::vector<ActiveEmitter> active;
+
+    static bool readHeader(const MappedFile& file, PatternFileHeader& header, std::string& why) {
+        if (file.size() < sizeof(PatternFileHeader)) { why = "truncated header"; return false; }
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, PATTERN_MAGIC, 4) != 0) { why = "not a binary pattern"; return false; }
+        if (header.version < 1 || header.version > PATTERN_VERSION) { why = "unsupported pattern version"; return false; }
+        if (header.version < 2) header.emitterCount = 0; //reserved and zero before emitters existed
+        const bool delta = (header.flags & PATTERN_DELTA_TIMES) != 0;
+        if (header.recordSize != (delta ? 10u : 12u)) { why = "bad record size"; return false; }
+        if (file.size() != sizeof(PatternFileHeader) + static_cast<size_t>(header.recordCount) * header.recordSize
+                + static_cast<size_t>(header.emitterCount) * sizeof(EmitterRecord)) {
+            why = "file size does not match record count";
+            return false;
+        }
+        if (Fnv1a(file.data() + sizeof(PatternFileHeader), file.size() - sizeof(PatternFileHeader)) != header.checksum) {
+            why = "checksum mismatch";
+            return false;
+        }
+        return true;
+    }
+
+    void loadText(const std::string& filename) {
         std::ifstream file(filename);
         if (!file) throw std::runtime_error("Pattern file not found");
         std::string line;
         while (std::getline(file, line)) {
             if (line.empty() || line[0] == '#') continue;
             std::istringstream iss(line);
+            if (line.compare(0, 5, "emit ") == 0) {
+                std::string keyword;
+                iss >> keyword;
+                emitters.push_back(parseEmitter(iss));
+                continue;
+            }
             BulletSpawn spawn;
             if (!(iss >> spawn.time >> spawn.x >> spawn.y >> spawn.dx >> spawn.dy))
                 throw std::runtime_error("Invalid pattern file format");
             spawns.push_back(spawn);
         }
-        std::sort(spawns.begin(), spawns.end(), [](const BulletSpawn& a, const BulletSpawn& b) {
+        std::stable_sort(spawns.begin(), spawns.end(), [](const BulletSpawn& a, const BulletSpawn& b) {
+            return a.time < b.time;
+            });
+        sortEmitters();
+    }
+
+    //"emit time x y count step period repeats aim [speed=N] [angle=D] [spin=D] [char=C]"
+    static Emitter parseEmitter(std::istringstream& iss) {
+        Emitter e;
+        int aim = 0;
+        if (!(iss >> e.time >> e.x >> e.y >> e.count >> e.angleStep >> e.period >> e.repeats >> aim))
+            throw std::runtime_error("Invalid emitter line");
+        e.aim = aim != 0;
+        std::string option;
+        while (iss >> option) {
+            const size_t eq = option.find('=');
+            if (eq == std::string::npos || eq + 1 == option.size()) throw std::runtime_error("Invalid emitter option " + option);
+            const std::string key = option.substr(0, eq), value = option.substr(eq + 1);
+            if (key == "speed") e.speed = std::stoi(value);
+            else if (key == "angle") e.angle = std::stof(value);
+            else if (key == "spin") e.spin = std::stof(value);
+            else if (key == "char") e.symbol = value[0];
+            else throw std::runtime_error("Unknown emitter option " + key);
+        }
+        if (e.count < 1 || e.period < 1 || e.repeats < 1 || e.speed < 1)
+            throw std::runtime_error("Emitter count, period, repeats and speed must be positive");
+        return e;
+    }
+
+    void sortEmitters() {
+        std::stable_sort(emitters.begin(), emitters.end(), [](const Emitter& a, const Emitter& b) {
             return a.time < b.time;
             });
     }
-    void spawnBullets(int frame, std::vector<std::unique_ptr<Bullet>>& bullets) {
-        while (nextSpawn < spawns.size() && spawns[nextSpawn].time <= frame) {
-            const auto& s = spawns[nextSpawn];
-            bullets.push_back(std::make_unique<Bullet>(s.x, s.y, s.dx, s.dy));
+
+    void loadEmitters(const unsigned char* data, size_t count) {
+        emitters.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            EmitterRecord r;
+            std::memcpy(&r, data + i * sizeof(r), sizeof(r));
+            Emitter e;
+            e.time = r.time;
+            e.x = r.x;
+            e.y = r.y;
+            e.count = std::max<int>(1, r.count);
+            e.angleStep = r.angleStep;
+            e.period = std::max<int>(1, r.period);
+            e.repeats = std::max<int>(1, r.repeats);
+            e.aim = r.aim != 0;
+            e.speed = std::max<int>(1, r.speed);
+            e.angle = r.angle;
+            e.spin = r.spin;
+            e.symbol = r.symbol;
+            emitters.push_back(e);
+        }
+        sortEmitters();
+    }
+
+    void runEmitters(int frame, BulletPool& bullets, int targetX, int targetY) {
+        while (nextEmitter < emitters.size() && emitters[nextEmitter].time <= frame) {
+            active.push_back(ActiveEmitter{ nextEmitter, emitters[nextEmitter].time, 0 });
+            nextEmitter++;
+        }
+        for (size_t i = 0; i < active.size();) {
+            ActiveEmitter& a = active[i];
+            const Emitter& e = emitters[a.index];
+            //a late start catches up on every emission already due rather than dropping them
+            while (a.fired < e.repeats && a.nextTime <= frame) {
+                fire(e, e.x, e.y, a.fired, targetX, targetY, bullets, arena);
+                a.fired++;
+                a.nextTime += e.period;
+            }
+            if (a.fired >= e.repeats) {
+                active[i] = active.back();
+                active.pop_back();
+            } else {
+                ++i;
+            }
+        }
+    }
+
+    void spawnMapped(int frame, BulletPool& bullets) {
+        while (nextSpawn < recordCount) {
+            const unsigned char* r = records + nextSpawn * recordSize;
+            int time;
+            if (deltaTimes) {
+                uint16_t dt;
+                std::memcpy(&dt, r, sizeof(dt));
+                time = lastTime + dt;
+                r += sizeof(dt);
+            } else {
+                int32_t t;
+                std::memcpy(&t, r, sizeof(t));
+                time = t;
+                r += sizeof(t);
+                if (time < lastTime) {
+                    //corrupt from here on, drop the rest rather than spawn out of order
+                    error = "pattern record " + std::to_string(nextSpawn) + " is out of time order";
+                    recordCount = nextSpawn;
+                    break;
+                }
+            }
+            if (time > frame) break;
+            int16_t f[4];
+            std::memcpy(f, r, sizeof(f));
+            bullets.spawn(f[0], f[1], f[2], f[3]);
+            lastTime = time;
             nextSpawn++;
         }
     }
-};
 
-class Enemy {
 public:
-    int x, y;
-    int hp = 10;
-    int maxHp = 10;
-    int fireCooldown = 60;
-    int fireTimer = 0;
-    int dx = 0, dy = 0;
-    int moveTimer = 0;
-    int moveFrameCounter = 0;
-    int burstSteps = 0;
-    int pauseTimer = 0;
-    std::vector<std::string> shape;
-    Enemy(int x_, int y_) : x(x_), y(y_), shape({ "#" }) {}
-    virtual ~Enemy() {}
-    virtual void update() {
-        static std::mt19937 rng(std::random_device{}());
-        static std::uniform_int_distribution<int> dirDist(-1, 1);
-
-        if (pauseTimer > 0) {
-            pauseTimer--;
-            if (fireTimer > 0) fireTimer--;
+    //binary patterns are recognised by their magic, anything else is parsed as "time x y dx dy" text
+    void loadPattern(const std::string& filename) {
+        if (mapped.open(filename) && mapped.size() >= 4 && std::memcmp(mapped.data(), PATTERN_MAGIC, 4) == 0) {
+            PatternFileHeader header;
+            std::string why;
+            if (!readHeader(mapped, header, why)) {
+                mapped.close();
+                throw std::runtime_error("Invalid binary pattern: " + why);
+            }
+            deltaTimes = (header.flags & PATTERN_DELTA_TIMES) != 0;
+            recordSize = header.recordSize;
+            recordCount = header.recordCount;
+            records = mapped.data() + sizeof(PatternFileHeader);
+            loadEmitters(records + recordCount * recordSize, header.emitterCount);
+            active.reserve(emitters.size());
             return;
         }
-        if (burstSteps <= 0) {
-            dx = dirDist(rng);
-            dy = dirDist(rng);
-            burstSteps = 5;
-            pauseTimer = 16;
+        mapped.close();
+        loadText(filename);
+        active.reserve(emitters.size()); //never more running than there are
+    }
+
+    void setArena(const Arena& arena_) { arena = arena_; }
+
+    //targetX/Y is where aimed emitters point
+    void spawnBullets(int frame, BulletPool& bullets, int targetX, int targetY) {
+        if (records) {
+            spawnMapped(frame, bullets);
+        } else {
+            while (nextSpawn < spawns.size() && spawns[nextSpawn].time <= frame) {
+                const auto& s = spawns[nextSpawn];
+                bullets.spawn(s.x, s.y, s.dx, s.dy);
+                nextSpawn++;
+            }
         }
-        moveFrameCounter++;
-        if (moveFrameCounter >= 3) {
-            x += dx;
-            y += dy;
-            moveFrameCounter = 0;
-            burstSteps--;
+        if (!active.empty() || nextEmitter < emitters.size()) runEmitters(frame, bullets, targetX, targetY);
+    }
+
+    //one emission of e from (x, y); directions are scaled so the larger axis moves speed cells a frame,
+    //which keeps every bullet of a ring on the same square wavefront
+    static void fire(const Emitter& e, int x, int y, int emission, int targetX, int targetY, BulletPool& bullets,
+                     const Arena& arena) {
+        if (!InArena(arena, x, y)) return;
+        const double degrees = 3.14159265358979323846 / 180.0;
+        double first = e.angle + static_cast<double>(e.spin) * emission;
+        if (e.aim && (targetX != x || targetY != y))
+            first += std::atan2(static_cast<double>(targetY - y), static_cast<double>(targetX - x)) / degrees
+                - 0.5 * e.angleStep * (e.count - 1);
+        for (int i = 0; i < e.count; ++i) {
+            const double a = (first + static_cast<double>(e.angleStep) * i) * degrees;
+            const double c = std::cos(a), s = std::sin(a);
+            const double scale = e.speed / std::max(std::fabs(c), std::fabs(s));
+            bullets.spawn(x, y, static_cast<int>(std::lround(c * scale)), static_cast<int>(std::lround(s * scale)),
+                e.symbol, BulletOwner::Enemy);
         }
-        if (x < 0) x = 0;
-        if (x > GRID_COLS - 1) x = GRID_COLS - 1;
-        if (y < 0) y = 0;
-        if (y > GRID_ROWS - 1) y = GRID_ROWS - 1;
-        if (fireTimer > 0) fireTimer--;
     }
-    virtual bool canFire() const { return fireTimer == 0; }
-    virtual void resetFire() { fireTimer = fireCooldown; }
-    virtual bool isRayEnemy() const { return false; }
-    bool isAlive() const { return hp > 0; }
-};
 
-class RayEnemy : public Enemy {
-public:
-    enum class State { Cooldown, Flashing, Firing };
+    //how far through the pattern and its emitters spawning has got, the pattern itself is not copied
+    template <typename Archive>
+    void transferCursor(Archive& a) {
+        a.pod(nextSpawn); a.pod(lastTime); a.pod(nextEmitter); a.array(active);
+    }
 
-    static constexpr int FLASH_FRAMES = (1000 + FRAME_MS - 1) / FRAME_MS;
-    static constexpr int FIRE_FRAMES  = (1500 + FRAME_MS - 1) / FRAME_MS;
-    static constexpr int COOLDOWN_FRAMES = (4000 + FRAME_MS - 1) / FRAME_MS;
+    //why spawning stopped early, empty while the pattern is intact
+    const std::string& lastError() const { return error; }
 
-    static constexpr int DAMAGE = 2; // damage dealt once per firing cycle
+    //writes the loaded text pattern in binary form, delta times fall back to absolute when a gap exceeds 16 bits
+    static void convert(const std::string& textFile, const std::string& binaryFile, bool delta) {
+        BulletManager source;
+        source.loadText(textFile);
+        const std::vector<BulletSpawn>& spawns = source.spawns;
+        int previous = 0;
+        for (const BulletSpawn& s : spawns) {
+            if (s.time < 0) throw std::runtime_error("Negative spawn time");
+            const int fields[4] = { s.x, s.y, s.dx, s.dy };
+            for (int f : fields) {
+                if (f < std::numeric_limits<int16_t>::min() || f > std::numeric_limits<int16_t>::max())
+                    throw std::runtime_error("Spawn field does not fit in 16 bits");
+            }
+            if (s.time - previous > std::numeric_limits<uint16_t>::max()) delta = false;
+            previous = s.time;
+        }
+
+        std::vector<unsigned char> body;
+        const size_t recordSize = delta ? 10 : 12;
+        body.reserve(spawns.size() * recordSize);
+        previous = 0;
+        for (const BulletSpawn& s : spawns) {
+            unsigned char record[12];
+            size_t at = 0;
+            if (delta) {
+                const uint16_t dt = static_cast<uint16_t>(s.time - previous);
+                std::memcpy(record, &dt, sizeof(dt));
+                at = sizeof(dt);
+            } else {
+                const int32_t t = s.time;
+                std::memcpy(record, &t, sizeof(t));
+                at = sizeof(t);
+            }
+            const int16_t f[4] = { static_cast<int16_t>(s.x), static_cast<int16_t>(s.y),
+                                   static_cast<int16_t>(s.dx), static_cast<int16_t>(s.dy) };
+            std::memcpy(record + at, f, sizeof(f));
+            body.insert(body.end(), record, record + recordSize);
+            previous = s.time;
+        }
+        for (const Emitter& e : source.emitters) {
+            const int fields[6] = { e.x, e.y, e.count, e.period, e.repeats, e.speed };
+            for (int f : fields) {
+                if (f < std::numeric_limits<int16_t>::min() || f > std::numeric_limits<int16_t>::max())
+                    throw std::runtime_error("Emitter field does not fit in 16 bits");
+            }
+            EmitterRecord r = {};
+            r.time = e.time;
+            r.x = static_cast<int16_t>(e.x);
+            r.y = static_cast<int16_t>(e.y);
+            r.count = static_cast<int16_t>(e.count);
+            r.period = static_cast<int16_t>(e.period);
+            r.repeats = static_cast<int16_t>(e.repeats);
+            r.speed = static_cast<int16_t>(e.speed);
+            r.angleStep = e.angleStep;
+            r.angle = e.angle;
+            r.spin = e.spin;
+            r.aim = e.aim ? 1 : 0;
+            r.symbol = e.symbol;
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&r);
+            body.insert(body.end(), bytes, bytes + sizeof(r));
+        }
 
-    State state = State::Cooldown;
-    int timer = COOLDOWN_FRAMES;
-    bool playerDamagedThisFire = false;
+        PatternFileHeader header = {};
+        std::memcpy(header.magic, PATTERN_MAGIC, 4);
+        header.version = PATTERN_VERSION;
+        header.flags = delta ? PATTERN_DELTA_TIMES : 0;
+        header.recordCount = static_cast<uint32_t>(spawns.size());
+        header.recordSize = static_cast<uint32_t>(recordSize);
+        header.emitterCount = static_cast<uint32_t>(source.emitters.size());
+        header.checksum = Fnv1a(body.data(), body.size());
 
-    RayEnemy(int x_, int y_) : Enemy(x_, y_) {
-        shape = { "@" };
-        hp = maxHp = 20;
+        std::ofstream out(binaryFile, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("Cannot write " + binaryFile);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(body.data()), static_cast<std::streamsize>(body.size()));
+        if (!out) throw std::runtime_error("Failed writing " + binaryFile);
     }
 
-    void update() override {
-        switch (state) {
-            case State::Cooldown:
-                Enemy::update();
-                if (--timer <= 0) {
-                    state = State::Flashing;
-                    timer = FLASH_FRAMES;
-                }
-                break;
-            case State::Flashing:
-                if (--timer <= 0) {
-                    state = State::Firing;
-                    timer = FIRE_FRAMES;
-                    playerDamagedThisFire = false;
-                }
-                break;
-            case State::Firing:
-                if (--timer <= 0) {
-                    state = State::Cooldown;
-                    timer = COOLDOWN_FRAMES;
-                    playerDamagedThisFire = false;
-                }
-                break;
+    //full check of a binary pattern: what loading checks plus spawn time order
+    static bool validate(const std::string& binaryFile, std::string& why) {
+        MappedFile file;
+        if (!file.open(binaryFile)) { why = "cannot open file"; return false; }
+        PatternFileHeader header;
+        if (!readHeader(file, header, why)) return false;
+        const unsigned char* body = file.data() + sizeof(PatternFileHeader);
+        if (header.flags & PATTERN_DELTA_TIMES) return true; //unsigned deltas cannot go backwards
+        int32_t previous = 0;
+        for (uint32_t i = 0; i < header.recordCount; ++i) {
+            int32_t t;
+            std::memcpy(&t, body + static_cast<size_t>(i) * header.recordSize, sizeof(t));
+            if (t < previous) {
+                why = "record " + std::to_string(i) + " is out of time order";
+                return false;
+            }
+            previous = t;
         }
+        return true;
     }
-
-    bool canFire() const override { return false; }
-    void resetFire() override {}
-    bool isRayEnemy() const override { return true; }
-
-    bool isFlashing() const { return state == State::Flashing; }
-    bool isFiring() const { return state == State::Firing; }
 };
 
-class Boss : public Enemy {
-public:
-    Boss(int x_, int y_) : Enemy(x_, y_) {
-        shape = { "<#>", " V" };
-        hp = maxHp = 150;
-        fireCooldown = 60;
+enum class EnemyKind { Basic, Ray, Boss };
+
+static const std::vector<std::string>& GetEnemyShape(EnemyKind kind) {
+    static const std::vector<std::string> basic = { "#" };
+    static const std::vector<std::string> ray = { "@" };
+    static const std::vector<std::string> boss = { "<#>", " V" };
+    switch (kind) {
+    case EnemyKind::Ray:  return ray;
+    case EnemyKind::Boss: return boss;
+    default:              return basic;
     }
+}
+
+//cells a player bullet hits the enemy from: its shape plus the four adjacent cells
+static const ShapeMask& GetEnemyHitMask(EnemyKind kind) {
+    static const ShapeMask masks[] = {
+        ShapeMask::compile(GetEnemyShape(EnemyKind::Basic)).dilated(),
+        ShapeMask::compile(GetEnemyShape(EnemyKind::Ray)).dilated(),
+        ShapeMask::compile(GetEnemyShape(EnemyKind::Boss)).dilated()
+    };
+    return masks[static_cast<int>(kind)];
+}
+
+enum class RayState : unsigned char { Cooldown, Flashing, Firing };
+
+struct EnemyStats {
+    int hp;
+    int fireCooldown; //0 never fires bullets
 };
 
-class Renderer {
+static const EnemyStats& GetEnemyStats(EnemyKind kind) {
+    static const EnemyStats stats[] = { { 10, 60 }, { 20, 0 }, { 150, 60 } };
+    return stats[static_cast<int>(kind)];
+}
+
+//counter based generator (Widynski's squares): every value is a pure function of the key and a
+//counter, so what an enemy draws depends on (game seed, enemy serial, tick) and not on which
+//enemies drew before it; usable with the std distributions like any other bit generator
+class CounterRng {
+    uint64_t key;
+    uint64_t counter;
 public:
-    void draw(const Player& player, const std::vector<std::unique_ptr<Enemy>>& enemies, const std::vector<std::unique_ptr<Bullet>>& bullets, int frame) {
-        int barWidth = GRID_COLS;
+    using result_type = uint32_t;
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 0xFFFFFFFFu; }
 
-        int clampedHp = player.hp;
-        if (clampedHp < 0) clampedHp = 0;
-        if (clampedHp > player.maxHp) {
-            clampedHp = player.maxHp;
-        }
+    //serial in the top 24 bits of the counter, tick in the next 28, the low 12 count draws
+    CounterRng(uint64_t key_, uint32_t serial, uint32_t tick)
+        : key(key_), counter((uint64_t(serial) << 40) | (uint64_t(tick & 0xFFFFFFFu) << 12)) {}
 
-        int hpBarLength = 0;
-        if (player.maxHp > 0) {
-            hpBarLength = (clampedHp * barWidth) / player.maxHp;
-        }
-        if (hpBarLength < 0) hpBarLength = 0;
-        if (hpBarLength > barWidth) {
-            hpBarLength = barWidth;
-        }
-        int hpSpaces = barWidth - hpBarLength;
-        if (hpSpaces < 0) hpSpaces = 0;
+    result_type operator()() {
+        uint64_t x = counter++ * key;
+        const uint64_t y = x, z = y + key;
+        x = x * x + y; x = (x >> 32) | (x << 32);
+        x = x * x + z; x = (x >> 32) | (x << 32);
+        x = x * x + y; x = (x >> 32) | (x << 32);
+        return static_cast<result_type>((x * x + z) >> 32);
+    }
 
-        int clampedMoney = player.money;
-        if (clampedMoney < 0) clampedMoney = 0;
-        if (clampedMoney > player.maxMoney) {
-            clampedMoney = player.maxMoney;
-        }
+    //splitmix64 of the seed, odd as squares needs
+    static uint64_t KeyFor(unsigned int seed) {
+        uint64_t x = seed + 0x9E3779B97F4A7C15ull;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+        return (x ^ (x >> 31)) | 1;
+    }
+};
 
-        int moneyBarLength = 0;
-        if (player.maxMoney > 0) {
-            moneyBarLength = (clampedMoney * barWidth) / player.maxMoney;
-        }
-        if (moneyBarLength < 0) moneyBarLength = 0;
-        if (moneyBarLength > barWidth) moneyBarLength = barWidth;
-        int moneySpaces = barWidth - moneyBarLength;
-        if (moneySpaces < 0) moneySpaces = 0;
+//one kind of enemy as parallel component arrays, element i of every vector is the same enemy
+struct EnemyBatch {
+    const EnemyKind kind;
+    std::vector<int> x, y, hp;
+    std::vector<int> fireTick; //enemy tick of the next shot, due straight away when not after the current one
+    std::vector<int> dx, dy, moveFrameCounter, burstSteps;
+    std::vector<int> pauseEndTick; //last enemy tick of the pause before the next burst
+    std::vector<uint32_t> slot; //EnemyStore slot, also the EnemyGrid key
 
-        std::string hpBar = std::string("HP: [") + std::string(hpBarLength, '#') + std::string(hpSpaces, ' ') + "]";
-        std::string moneyBar = std::string("$:  [") + std::string(moneyBarLength, '#') + std::string(moneySpaces, ' ') + "]";
+    explicit EnemyBatch(EnemyKind kind_) : kind(kind_) {}
+    size_t size() const { return x.size(); }
+    bool isAlive(size_t i) const { return hp[i] > 0; }
 
-        clearScreen();
-        std::cout << hpBar << "\n" << moneyBar << "\n";
+    size_t add(uint32_t slot_, int x_, int y_, int tick) {
+        x.push_back(x_);
+        y.push_back(y_);
+        hp.push_back(GetEnemyStats(kind).hp);
+        fireTick.push_back(tick);
+        dx.push_back(0);
+        dy.push_back(0);
+        moveFrameCounter.push_back(0);
+        burstSteps.push_back(0);
+        pauseEndTick.push_back(tick);
+        slot.push_back(slot_);
+        return x.size() - 1;
+    }
+    void moveElement(size_t from, size_t to) {
+        x[to] = x[from];
+        y[to] = y[from];
+        hp[to] = hp[from];
+        fireTick[to] = fireTick[from];
+        dx[to] = dx[from];
+        dy[to] = dy[from];
+        moveFrameCounter[to] = moveFrameCounter[from];
+        burstSteps[to] = burstSteps[from];
+        pauseEndTick[to] = pauseEndTick[from];
+        slot[to] = slot[from];
+    }
+    void reserve(size_t n) {
+        x.reserve(n); y.reserve(n); hp.reserve(n); fireTick.reserve(n); dx.reserve(n); dy.reserve(n);
+        moveFrameCounter.reserve(n); burstSteps.reserve(n); pauseEndTick.reserve(n); slot.reserve(n);
+    }
+    template <typename Archive>
+    void transfer(Archive& a) {
+        a.array(x); a.array(y); a.array(hp); a.array(fireTick); a.array(dx); a.array(dy);
+        a.array(moveFrameCounter); a.array(burstSteps); a.array(pauseEndTick); a.array(slot);
+    }
+    void resize(size_t n) {
+        x.resize(n);
+        y.resize(n);
+        hp.resize(n);
+        fireTick.resize(n);
+        dx.resize(n);
+        dy.resize(n);
+        moveFrameCounter.resize(n);
+        burstSteps.resize(n);
+        pauseEndTick.resize(n);
+        slot.resize(n);
+    }
 
-        std::vector<std::string> grid(GRID_ROWS + 2, std::string(GRID_COLS + 2, ' '));
-        grid[0][0] = grid[GRID_ROWS + 1][0] = '+';
-        grid[0][GRID_COLS + 1] = grid[GRID_ROWS + 1][GRID_COLS + 1] = '+';
-        for (int x = 1; x <= GRID_COLS; ++x) {
-            grid[0][x] = '-';
-            grid[GRID_ROWS + 1][x] = '-';
+    //bursts of 5 steps in a random direction, one step every 3 frames, with a 16 frame pause before each burst;
+    //the pause is a deadline like the shots, so a pausing enemy costs one compare a tick
+    template <typename A>
+    void wander(size_t i, int tick, CounterRng& rng, const A& arena) {
+        std::uniform_int_distribution<int> dirDist(-1, 1);
+
+        if (tick <= pauseEndTick[i]) return;
+        if (burstSteps[i] <= 0) {
+            dx[i] = dirDist(rng);
+            dy[i] = dirDist(rng);
+            burstSteps[i] = 5;
+            pauseEndTick[i] = tick + 16;
         }
-        for (int y = 1; y <= GRID_ROWS; ++y) {
-            grid[y][0] = '|';
-            grid[y][GRID_COLS + 1] = '|';
+        moveFrameCounter[i]++;
+        if (moveFrameCounter[i] >= 3) {
+            x[i] += dx[i];
+            y[i] += dy[i];
+            moveFrameCounter[i] = 0;
+            burstSteps[i]--;
+        }
+        if (x[i] < 0) x[i] = 0;
+        if (x[i] > arena.cols - 1) x[i] = arena.cols - 1;
+        if (y[i] < 0) y[i] = 0;
+        if (y[i] > arena.rows - 1) y[i] = arena.rows - 1;
+    }
+};
+
+//ray enemies wander only while cooling down, then flash a warning cross and fire it
+struct RayBatch : EnemyBatch {
+    static constexpr int FLASH_FRAMES = (1000 + FRAME_MS - 1) / FRAME_MS;
+    static constexpr int FIRE_FRAMES  = (1500 + FRAME_MS - 1) / FRAME_MS;
+    static constexpr int COOLDOWN_FRAMES = (4000 + FRAME_MS - 1) / FRAME_MS;
+
+    static constexpr int DAMAGE = 2; // damage dealt once per firing cycle
+
+    std::vector<RayState> state;
+    std::vector<int> stateEndTick; //enemy tick the current state hands over to the next
+    std::vector<char> playerDamagedThisFire;
+
+    RayBatch() : EnemyBatch(EnemyKind::Ray) {}
+
+    size_t add(uint32_t slot_, int x_, int y_, int tick) {
+        state.push_back(RayState::Cooldown);
+        stateEndTick.push_back(tick + COOLDOWN_FRAMES);
+        playerDamagedThisFire.push_back(0);
+        return EnemyBatch::add(slot_, x_, y_, tick);
+    }
+    void moveElement(size_t from, size_t to) {
+        EnemyBatch::moveElement(from, to);
+        state[to] = state[from];
+        stateEndTick[to] = stateEndTick[from];
+        playerDamagedThisFire[to] = playerDamagedThisFire[from];
+    }
+    void reserve(size_t n) {
+        EnemyBatch::reserve(n);
+        state.reserve(n); stateEndTick.reserve(n); playerDamagedThisFire.reserve(n);
+    }
+    template <typename Archive>
+    void transfer(Archive& a) {
+        EnemyBatch::transfer(a);
+        a.array(state); a.array(stateEndTick); a.array(playerDamagedThisFire);
+    }
+    void resize(size_t n) {
+        EnemyBatch::resize(n);
+        state.resize(n);
+        stateEndTick.resize(n);
+        playerDamagedThisFire.resize(n);
+    }
+
+    //moves ray i on to its next state at tick now, returns the tick that state ends on
+    int advanceState(size_t i, int now) {
+        switch (state[i]) {
+            case RayState::Cooldown:
+                state[i] = RayState::Flashing;
+                stateEndTick[i] = now + FLASH_FRAMES;
+                if (pauseEndTick[i] > now) pauseEndTick[i] += FLASH_FRAMES + FIRE_FRAMES; //held over to the next cooldown
+                break;
+            case RayState::Flashing:
+                state[i] = RayState::Firing;
+                stateEndTick[i] = now + FIRE_FRAMES;
+                playerDamagedThisFire[i] = 0;
+                break;
+            case RayState::Firing:
+                state[i] = RayState::Cooldown;
+                stateEndTick[i] = now + COOLDOWN_FRAMES;
+                playerDamagedThisFire[i] = 0;
+                break;
+        }
+        return stateEndTick[i];
+    }
+    //tick wandering picks up from, where a pause held over from the last cooldown is measured
+    int wanderResumeTick(size_t i, int now) const {
+        if (state[i] == RayState::Cooldown) return now;
+        return state[i] == RayState::Flashing ? stateEndTick[i] + FIRE_FRAMES : stateEndTick[i];
+    }
+};
+
+constexpr int RayBatch::FLASH_FRAMES;
+constexpr int RayBatch::FIRE_FRAMES;
+constexpr int RayBatch::COOLDOWN_FRAMES;
+constexpr int RayBatch::DAMAGE;
+
+//names one enemy for as long as it lives, a handle kept past its death no longer resolves
+struct EnemyHandle {
+    uint32_t slot;
+    uint32_t generation;
+};
+
+//every live enemy, stored by kind so each system walks only the batches it needs; batches hold
+//nothing but the living outside the hit phase, and slots of the dead are reused through a free list
+class EnemyStore {
+public:
+    struct Slot {
+        EnemyKind kind;
+        uint32_t index;      //position in the kind's batch
+        uint32_t generation; //bumped on release so stale handles stop matching
+        uint32_t serial;     //spawn order, the earliest spawned enemy takes a contested hit
+    };
+    EnemyBatch basics{ EnemyKind::Basic };
+    RayBatch rays;
+    EnemyBatch bosses{ EnemyKind::Boss };
+    std::vector<Slot> slots;
+
+    //room for a long game's population up front, batches grow past it only in extreme runs
+    EnemyStore() {
+        basics.reserve(256);
+        rays.reserve(256);
+        bosses.reserve(32);
+        slots.reserve(1024);
+        freeSlots.reserve(1024);
+    }
+
+    EnemyBatch& batch(EnemyKind kind) {
+        switch (kind) {
+        case EnemyKind::Ray:  return rays;
+        case EnemyKind::Boss: return bosses;
+        default:              return basics;
+        }
+    }
+    EnemyHandle spawn(EnemyKind kind, int x, int y, int tick) {
+        uint32_t s;
+        if (!freeSlots.empty()) {
+            s = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            s = static_cast<uint32_t>(slots.size());
+            slots.push_back(Slot{ kind, 0, 0, 0 });
+        }
+        const size_t index = kind == EnemyKind::Ray ? rays.add(s, x, y, tick) : batch(kind).add(s, x, y, tick);
+        Slot& slot = slots[s];
+        slot.kind = kind;
+        slot.index = static_cast<uint32_t>(index);
+        slot.serial = spawned++;
+        return EnemyHandle{ s, slot.generation };
+    }
+    bool valid(EnemyHandle h) const {
+        return h.slot < slots.size() && slots[h.slot].generation == h.generation;
+    }
+    EnemyHandle handle(uint32_t slot) const { return EnemyHandle{ slot, slots[slot].generation }; }
+    //drops every enemy at 0 hp, survivors keep their order so the AI passes replay identically
+    void reclaim() {
+        reclaim(basics);
+        reclaim(rays);
+        reclaim(bosses);
+    }
+    template <typename Archive>
+    void transfer(Archive& a) {
+        basics.transfer(a); rays.transfer(a); bosses.transfer(a);
+        a.array(slots); a.array(freeSlots); a.pod(spawned);
+    }
+    size_t spawnedCount() const { return spawned; }
+    size_t alive() const { return basics.size() + rays.size() + bosses.size(); }
+
+private:
+    std::vector<uint32_t> freeSlots;
+    uint32_t spawned = 0;
+
+    template <typename Batch>
+    void reclaim(Batch& b) {
+        size_t kept = 0;
+        for (size_t i = 0; i < b.size(); ++i) {
+            if (!b.isAlive(i)) {
+                slots[b.slot[i]].generation++;
+                freeSlots.push_back(b.slot[i]);
+                continue;
+            }
+            if (kept != i) {
+                b.moveElement(i, kept);
+                slots[b.slot[kept]].index = static_cast<uint32_t>(kept);
+            }
+            ++kept;
+        }
+        b.resize(kept);
+    }
+};
+
+//hierarchical timing wheel: level L is a ring of 64 slots for timers due 64^L to 64^(L+1) ticks
+//ahead, indexed by those bits of the due time; when time reaches a higher slot its timers are
+//spread over the levels below, so a tick touches only the timers due then and the odd cascade.
+//slots are lists threaded through one pool, timers due on the same tick fire in no set order
+template <typename Event>
+class TimerWheel {
+    static constexpr int BITS = 6;
+    static constexpr int SLOTS = 1 << BITS;
+    static constexpr int LEVELS = 4;
+    static constexpr int64_t REACH = int64_t(1) << (BITS * LEVELS);
+    static constexpr int NONE = -1;
+    struct Timer {
+        int64_t due;
+        Event event;
+        int next;
+    };
+    std::vector<Timer> timers;
+    int freeTimers = NONE;
+    int slots[LEVELS][SLOTS];
+    int overflow = NONE; //further ahead than the top level reaches
+    int64_t now = 0;
+
+    void place(int index) {
+        Timer& timer = timers[index];
+        const int64_t ahead = timer.due - now;
+        int* head = &overflow;
+        for (int level = 0; level < LEVELS; ++level) {
+            if (ahead < (int64_t(1) << (BITS * (level + 1)))) {
+                head = &slots[level][(timer.due >> (BITS * level)) & (SLOTS - 1)];
+                break;
+            }
+        }
+        timer.next = *head;
+        *head = index;
+    }
+    //the timers of a cascading slot are all due within the level's span so none land back in it,
+    //overflow timers still out of reach go back to the overflow list
+    void cascade(int& head) {
+        int index = head;
+        head = NONE;
+        while (index != NONE) {
+            const int next = timers[index].next;
+            place(index);
+            index = next;
+        }
+    }
+
+public:
+    //capacity timers are reserved up front so a steady population schedules without allocating
+    explicit TimerWheel(size_t capacity) {
+        timers.reserve(capacity);
+        reset(0);
+    }
+
+    int64_t time() const { return now; }
+    void reset(int64_t time) {
+        timers.clear();
+        freeTimers = NONE;
+        for (auto& level : slots) std::fill(std::begin(level), std::end(level), NONE);
+        overflow = NONE;
+        now = time;
+    }
+    //a due time not after the current one fires on the next tick
+    void schedule(int64_t due, const Event& event) {
+        int index = freeTimers;
+        if (index != NONE) {
+            freeTimers = timers[index].next;
+            timers[index] = Timer{ std::max(due, now + 1), event, NONE };
+        } else {
+            index = static_cast<int>(timers.size());
+            timers.push_back(Timer{ std::max(due, now + 1), event, NONE });
+        }
+        place(index);
+    }
+    //moves time on to `to` one tick at a time, calling fire(event) for each timer due on the way
+    template <typename Fire>
+    void advance(int64_t to, Fire fire) {
+        while (now < to) {
+            ++now;
+            if (!(now & (REACH - 1))) cascade(overflow);
+            for (int level = LEVELS - 1; level >= 1; --level) {
+                if (now & ((int64_t(1) << (BITS * level)) - 1)) continue;
+                cascade(slots[level][(now >> (BITS * level)) & (SLOTS - 1)]);
+            }
+            int& head = slots[0][now & (SLOTS - 1)];
+            int index = head;
+            head = NONE;
+            while (index != NONE) {
+                Timer& timer = timers[index];
+                const int next = timer.next;
+                const Event event = timer.event;
+                timer.next = freeTimers;
+                freeTimers = index;
+                fire(event);
+                index = next;
+            }
+        }
+    }
+};
+
+//buckets of enemy slots per arena cell, each enemy covers its hit mask (shape plus adjacent cells)
+//entries are moved only when an enemy changes position so a bullet resolves its hits with one lookup;
+//occupied has a bit for every non empty bucket so a whole frame of bullets can be ruled out at once.
+//an arena of up to DIRECT_CELLS cells has a bucket per cell; in a bigger one only covered cells have
+//a bucket, found through a linear probing table keyed on the cell, so the grid grows with the
+//population rather than with the arena
+class EnemyGrid {
+    struct Entry {
+        int x = 0, y = 0;
+        const ShapeMask* mask = nullptr;
+    };
+    struct Cell {
+        uint64_t key = 0; //cell index + 1, 0 marks a free table slot
+        uint32_t bucket = 0;
+    };
+    static constexpr size_t DIRECT_CELLS = size_t(1) << 16;
+    //buckets a sparse grid makes up front, past it they are added as needed
+    static constexpr size_t RESERVED_BUCKETS = 4096;
+    Arena arena;
+    bool direct;
+    std::vector<std::vector<int>> buckets; //by cell index when direct
+    std::vector<Cell> table; //sparse only, power of two size kept at most half full
+    size_t tableUsed = 0;
+    std::vector<uint32_t> freeBuckets;
+    std::vector<Entry> entries;
+    ArenaBits occupiedBits;
+    const std::vector<int> none;
+
+    size_t cellIndex(int x, int y) const { return static_cast<size_t>(y) * arena.cols + x; }
+    size_t home(uint64_t key) const { return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & (table.size() - 1); }
+    //table slot holding key, or the free slot ending its probe run
+    size_t find(uint64_t key) const {
+        size_t i = home(key);
+        while (table[i].key != 0 && table[i].key != key) i = (i + 1) & (table.size() - 1);
+        return i;
+    }
+    //sparse grid only, the cell's bucket made when it has none
+    std::vector<int>& sparseBucket(int x, int y) {
+        const uint64_t key = cellIndex(x, y) + 1;
+        size_t i = find(key);
+        if (table[i].key == 0) {
+            if ((tableUsed + 1) * 2 > table.size()) {
+                grow();
+                i = find(key);
+            }
+            table[i].key = key;
+            table[i].bucket = takeBucket();
+            ++tableUsed;
+        }
+        return buckets[table[i].bucket];
+    }
+    //sparse grid only, takes id out of the cell's bucket and drops the bucket once empty
+    void sparseRemove(int id, int x, int y) {
+        const size_t slot = find(cellIndex(x, y) + 1);
+        if (table[slot].key == 0) return;
+        std::vector<int>& bucket = buckets[table[slot].bucket];
+        for (size_t i = 0; i < bucket.size(); ++i) {
+            if (bucket[i] == id) {
+                bucket[i] = bucket.back();
+                bucket.pop_back();
+                break;
+            }
+        }
+        if (!bucket.empty()) return;
+        erase(slot);
+        occupiedBits.reset(arena, x, y);
+    }
+    uint32_t takeBucket() {
+        if (freeBuckets.empty()) {
+            buckets.emplace_back();
+            buckets.back().reserve(8);
+            return static_cast<uint32_t>(buckets.size() - 1);
+        }
+        const uint32_t b = freeBuckets.back();
+        freeBuckets.pop_back();
+        return b;
+    }
+    //frees table slot i, moving later entries of its probe run back so no lookup stops short of them
+    void erase(size_t i) {
+        freeBuckets.push_back(table[i].bucket);
+        const size_t mask = table.size() - 1;
+        for (size_t j = (i + 1) & mask; table[j].key != 0; j = (j + 1) & mask) {
+            const size_t h = home(table[j].key);
+            //entry j has to stay when its home lies cyclically in (i, j]
+            if (i <= j ? (h > i && h <= j) : (h > i || h <= j)) continue;
+            table[i] = table[j];
+            i = j;
+        }
+        table[i].key = 0;
+        --tableUsed;
+    }
+    void grow() {
+        std::vector<Cell> old(table.size() * 2);
+        old.swap(table);
+        for (const Cell& c : old) if (c.key) table[find(c.key)] = c;
+    }
+
+public:
+    //buckets start with room for a few overlapping enemies so moving them about does not allocate
+    explicit EnemyGrid(const Arena& arena_) : arena(arena_), occupiedBits(arena_) {
+        const size_t cells = static_cast<size_t>(arena.rows) * arena.cols;
+        direct = cells <= DIRECT_CELLS;
+        if (direct) {
+            buckets.resize(cells);
+            for (auto& bucket : buckets) bucket.reserve(8);
+        } else {
+            table.resize(2 * RESERVED_BUCKETS);
+            buckets.resize(RESERVED_BUCKETS);
+            freeBuckets.reserve(RESERVED_BUCKETS);
+            for (size_t b = RESERVED_BUCKETS; b-- > 0;) {
+                buckets[b].reserve(8);
+                freeBuckets.push_back(static_cast<uint32_t>(b));
+            }
+        }
+        entries.reserve(1024);
+    }
+
+    bool contains(int id) const {
+        return id >= 0 && id < static_cast<int>(entries.size()) && entries[id].mask != nullptr;
+    }
+    void insert(int id, int x, int y, const ShapeMask& mask) {
+        if (id >= static_cast<int>(entries.size())) entries.resize(id + 1);
+        entries[id].x = x;
+        entries[id].y = y;
+        entries[id].mask = &mask;
+        mask.forEachCell(arena, x, y, [&](int cx, int cy) {
+            (direct ? buckets[cellIndex(cx, cy)] : sparseBucket(cx, cy)).push_back(id);
+            occupiedBits.set(arena, cx, cy);
+            });
+    }
+    void remove(int id) {
+        if (!contains(id)) return;
+        Entry& e = entries[id];
+        e.mask->forEachCell(arena, e.x, e.y, [&](int cx, int cy) {
+            if (!direct) {
+                sparseRemove(id, cx, cy);
+                return;
+            }
+            std::vector<int>& bucket = buckets[cellIndex(cx, cy)];
+            for (size_t i = 0; i < bucket.size(); ++i) {
+                if (bucket[i] == id) {
+                    bucket[i] = bucket.back();
+                    bucket.pop_back();
+                    break;
+                }
+            }
+            if (bucket.empty()) occupiedBits.reset(arena, cx, cy);
+            });
+        e.mask = nullptr;
+    }
+    void sync(int id, int x, int y, const ShapeMask& mask) {
+        if (contains(id) && entries[id].x == x && entries[id].y == y) return;
+        remove(id);
+        insert(id, x, y, mask);
+    }
+    const std::vector<int>& at(int x, int y) const {
+        if (!InArena(arena, x, y)) return none;
+        if (direct) return buckets[cellIndex(x, y)];
+        const Cell& c = table[find(cellIndex(x, y) + 1)];
+        return c.key ? buckets[c.bucket] : none;
+    }
+    const ArenaBits& occupied() const { return occupiedBits; }
+    void clear() {
+        if (direct) {
+            for (auto& bucket : buckets) bucket.clear();
+        } else {
+            for (Cell& c : table) {
+                if (!c.key) continue;
+                buckets[c.bucket].clear();
+                freeBuckets.push_back(c.bucket);
+                c.key = 0;
+            }
+            tableUsed = 0;
+        }
+        entries.clear();
+        occupiedBits.clear();
+    }
+};
+
+constexpr size_t EnemyGrid::DIRECT_CELLS;
+constexpr size_t EnemyGrid::RESERVED_BUCKETS;
+
+struct EnemyView {
+    int x, y;
+    EnemyKind kind;
+};
+
+struct RayView {
+    int x, y;
+    RayState state;
+};
+
+//everything the renderer needs from one simulated frame, copied out so drawing never touches live state
+struct WorldSnapshot {
+    WorldSnapshot() {
+        enemies.reserve(256);
+        rays.reserve(128);
+        bulletX.reserve(4096);
+        bulletY.reserve(4096);
+        bulletSymbol.reserve(4096);
+    }
+    int frame = 0;
+    int score = 0;
+    Player player{ 0, 0 };
+    std::vector<EnemyView> enemies; //shaped enemies, rays are drawn separately
+    std::vector<RayView> rays;
+    std::vector<int> bulletX, bulletY;
+    std::vector<char> bulletSymbol;
+    bool upgradePending = false;
+    UpgradeType offered[3] = {};
+    char overlay[96] = {};
+};
+
+//lock-free hand over of the newest value between one writer and one reader, neither ever waits,
+//the writer fills its buffer and swaps it into the middle, the reader swaps the middle out when it is newer
+template <typename T>
+class TripleBuffer {
+    static constexpr int FRESH = 4;
+    T buffers[3];
+    std::atomic<int> middle{ 1 };
+    int writeIndex = 0;
+    int readIndex = 2;
+public:
+    T& writeBuffer() { return buffers[writeIndex]; }
+    void publish() { writeIndex = middle.exchange(writeIndex | FRESH) & ~FRESH; }
+    bool hasFresh() const { return (middle.load() & FRESH) != 0; }
+    //true when a newer value was taken
+    bool fetch() {
+        if (!hasFresh()) return false;
+        readIndex = middle.exchange(readIndex) & ~FRESH;
+        return true;
+    }
+    const T& readBuffer() const { return buffers[readIndex]; }
+};
+
+//splits [0, count) into chunks run by fixed workers and the calling thread, returning once all are
+//done; the body is passed by pointer rather than wrapped in a std::function so a run never allocates
+class ParallelFor {
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    //the current run, written under mutex before workers are woken
+    void (*call)(const void*, size_t, size_t) = nullptr;
+    const void* body = nullptr;
+    size_t count = 0, grain = 1;
+    std::atomic<size_t> next{ 0 };
+    unsigned generation = 0; //bumped per run, guarded by mutex
+    size_t busy = 0;         //workers not yet through the current run, guarded by mutex
+    bool stopping = false;   //guarded by mutex
+
+    void runChunks() {
+        for (;;) {
+            const size_t begin = next.fetch_add(grain);
+            if (begin >= count) return;
+            call(body, begin, std::min(count, begin + grain));
+        }
+    }
+    void workerLoop() {
+        unsigned seen = 0;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            runChunks();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0) done.notify_one();
+        }
+    }
+
+public:
+    //threads counts the caller, so 1 starts no workers and every run is serial
+    explicit ParallelFor(unsigned threads) {
+        for (unsigned i = 1; i < threads; ++i) workers.emplace_back(&ParallelFor::workerLoop, this);
+    }
+    ParallelFor(const ParallelFor&) = delete;
+    ParallelFor& operator=(const ParallelFor&) = delete;
+    ~ParallelFor() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : workers) t.join();
+    }
+    unsigned threads() const { return static_cast<unsigned>(workers.size()) + 1; }
+
+    //body(begin, end) over chunks of grain items, in one call on this thread when there is one chunk
+    template <typename Body>
+    void run(size_t count_, size_t grain_, const Body& body_) {
+        if (workers.empty() || count_ <= grain_) {
+            if (count_) body_(0, count_);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            call = [](const void* b, size_t begin, size_t end) { (*static_cast<const Body*>(b))(begin, end); };
+            body = &body_;
+            count = count_;
+            grain = grain_;
+            next = 0;
+            busy = workers.size();
+            ++generation;
+        }
+        wake.notify_all();
+        runChunks();
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return busy == 0; });
+    }
+};
+
+//the values around the arena a recorder wants without parsing cells
+struct BroadcastHud {
+    int32_t frame, score, hp, maxHp, money, maxMoney;
+};
+
+//finished frames in a POSIX shared memory ring for local spectators and recorders. the game writes
+//one slot per frame under that slot's seqlock and never waits: the sequence is odd while the slot is
+//written, and a reader that copied the newest slot retries when the sequence moved under it. the
+//game unlinks the segment when it ends and marks it closed for readers still attached
+class FrameBroadcast {
+public:
+    static constexpr uint32_t MAGIC = 0x42464444; //"DDFB"
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t SLOTS = 8;
+
+    FrameBroadcast() {}
+    FrameBroadcast(const FrameBroadcast&) = delete;
+    FrameBroadcast& operator=(const FrameBroadcast&) = delete;
+    ~FrameBroadcast() { close(); }
+
+    //creates the segment, replacing one a crashed game left behind
+    bool create(const std::string& name_, int rows, int cols) {
+        close();
+#ifdef _WIN32
+        (void)name_; (void)rows; (void)cols;
+        return false;
+#else
+        name = SegmentName(name_);
+        const size_t cells = static_cast<size_t>(rows) * cols;
+        const size_t bytes = sizeof(Header) + SLOTS * SlotBytes(cells);
+        shm_unlink(name.c_str());
+        const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0) return false;
+        void* p = MAP_FAILED;
+        if (ftruncate(fd, static_cast<off_t>(bytes)) == 0)
+            p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            shm_unlink(name.c_str());
+            return false;
+        }
+        base = static_cast<unsigned char*>(p);
+        length = bytes;
+        owner = true;
+        header = new (base) Header();
+        header->rows = static_cast<uint32_t>(rows);
+        header->cols = static_cast<uint32_t>(cols);
+        header->slotBytes = static_cast<uint32_t>(SlotBytes(cells));
+        for (uint32_t i = 0; i < SLOTS; ++i) new (slot(i)) Slot();
+        header->magic.store(MAGIC, std::memory_order_release);
+        return true;
+#endif
+    }
+
+    //maps a segment a running game created
+    bool attach(const std::string& name_) {
+        close();
+#ifdef _WIN32
+        (void)name_;
+        return false;
+#else
+        const int fd = shm_open(SegmentName(name_).c_str(), O_RDONLY, 0);
+        if (fd < 0) return false;
+        struct stat st;
+        void* p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(Header))
+            p = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return false;
+        base = static_cast<unsigned char*>(p);
+        length = static_cast<size_t>(st.st_size);
+        header = reinterpret_cast<Header*>(base);
+        if (header->magic.load(std::memory_order_acquire) != MAGIC || header->version != VERSION ||
+            length < sizeof(Header) + SLOTS * static_cast<size_t>(header->slotBytes) ||
+            header->slotBytes < SlotBytes(static_cast<size_t>(header->rows) * header->cols)) {
+            close();
+            return false;
+        }
+        return true;
+#endif
+    }
+
+    void close() {
+#ifndef _WIN32
+        if (!base) return;
+        if (owner) {
+            header->closed.store(1, std::memory_order_release);
+            shm_unlink(name.c_str());
+        }
+        munmap(base, length);
+#endif
+        base = nullptr;
+        header = nullptr;
+        length = 0;
+        owner = false;
+    }
+
+    int rows() const { return static_cast<int>(header->rows); }
+    int cols() const { return static_cast<int>(header->cols); }
+    bool closed() const { return header->closed.load(std::memory_order_acquire) != 0; }
+
+    //game side, rows x cols cells
+    void publish(const char* cells, const BroadcastHud& hud) {
+        const uint32_t n = header->published.load(std::memory_order_relaxed);
+        Slot* s = slot(n % SLOTS);
+        const uint32_t seq = s->seq.load(std::memory_order_relaxed);
+        s->seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        s->hud = hud;
+        std::memcpy(CellsOf(s), cells, static_cast<size_t>(header->rows) * header->cols);
+        s->seq.store(seq + 2, std::memory_order_release);
+        header->published.store(n + 1, std::memory_order_release);
+    }
+
+    //reader side, copies the newest frame into cells and hud; false when there is none newer than the last read
+    bool read(char* cells, BroadcastHud& hud) {
+        for (;;) {
+            const uint32_t n = header->published.load(std::memory_order_acquire);
+            if (n == lastRead) return false;
+            const Slot* s = slot((n - 1) % SLOTS);
+            const uint32_t seq = s->seq.load(std::memory_order_acquire);
+            if (seq & 1) continue;
+            hud = s->hud;
+            std::memcpy(cells, CellsOf(s), static_cast<size_t>(header->rows) * header->cols);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (s->seq.load(std::memory_order_relaxed) != seq) continue;
+            lastRead = n;
+            return true;
+        }
+    }
+
+private:
+    static_assert(ATOMIC_INT_LOCK_FREE == 2, "the ring's atomics must work across processes");
+    struct Header {
+        std::atomic<uint32_t> magic{ 0 }; //stored last, so a reader never sees a half made header
+        uint32_t version = VERSION;
+        uint32_t rows = 0, cols = 0;
+        uint32_t slotBytes = 0;
+        std::atomic<uint32_t> published{ 0 }; //frames written, the newest is in slot (published - 1) % SLOTS
+        std::atomic<uint32_t> closed{ 0 };
+    };
+    //followed by the cells
+    struct Slot {
+        std::atomic<uint32_t> seq{ 0 };
+        BroadcastHud hud = {};
+    };
+
+    unsigned char* base = nullptr;
+    size_t length = 0;
+    Header* header = nullptr;
+    bool owner = false;
+    std::string name;
+    uint32_t lastRead = 0;
+
+    static std::string SegmentName(const std::string& n) { return n.empty() || n[0] != '/' ? "/" + n : n; }
+    static size_t SlotBytes(size_t cells) { return (sizeof(Slot) + cells + 7) & ~static_cast<size_t>(7); }
+    static char* CellsOf(const Slot* s) { return reinterpret_cast<char*>(const_cast<Slot*>(s)) + sizeof(Slot); }
+    Slot* slot(uint32_t i) const { return reinterpret_cast<Slot*>(base + sizeof(Header) + i * static_cast<size_t>(header->slotBytes)); }
+};
+
+constexpr uint32_t FrameBroadcast::MAGIC;
+constexpr uint32_t FrameBroadcast::VERSION;
+constexpr uint32_t FrameBroadcast::SLOTS;
+
+#ifndef _WIN32
+static volatile std::sig_atomic_t g_terminalResized = 0;
+static void onTerminalResize(int) { g_terminalResized = 1; }
+
+//REP (CSI n b) is ignored by the Linux console and by vt100 style terminals, which leaves gaps in rows
+static bool TerminalRepeats() {
+    const char* term = std::getenv("TERM");
+    if (!term || !*term) return false;
+    const std::string name = term;
+    return name != "dumb" && name != "linux" && name.compare(0, 2, "vt") != 0;
+}
+#endif
+
+//double buffered cell renderer, each frame is composed into the back buffer and only the cells
+//that differ from the front buffer are sent, as cursor moves plus run-length encoded runs, in one write
+class Renderer {
+public:
+    static constexpr int ROWS = GRID_ROWS + 6; //hp bar, money bar, framed arena, status line, overlay line
+    static constexpr int COLS = GRID_COLS + 6;
+    static constexpr int ARENA_ROW = 2;
+
+    //repeatRuns false always writes runs out in full
+    explicit Renderer(bool repeatRuns = true) : front(ROWS * COLS, ' '), back(ROWS * COLS, ' ') {
+        out.reserve(ROWS * COLS * 2);
+#ifdef _WIN32
+        HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+        DWORD mode = 0;
+        if (hOut != INVALID_HANDLE_VALUE && GetConsoleMode(hOut, &mode))
+            vtEnabled = SetConsoleMode(hOut, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING) != 0;
+        useRepeat = false; //conhost does not implement REP
+        (void)repeatRuns;
+#else
+        useRepeat = repeatRuns && TerminalRepeats();
+        std::signal(SIGWINCH, onTerminalResize);
+#endif
+    }
+
+    void draw(const WorldSnapshot& world) {
+        compose(world);
+        if (world.overlay[0]) text(ROWS - 1, 0, world.overlay);
+        if (broadcast) {
+            const Player& p = world.player;
+            broadcast->publish(back.data(), BroadcastHud{ world.frame, world.score, p.hp, p.maxHp, p.money, p.maxMoney });
+        }
+        present();
+    }
+    //shows a frame another renderer composed, ROWS x COLS cells
+    void drawCells(const char* cells) {
+        std::copy(cells, cells + ROWS * COLS, back.begin());
+        present();
+    }
+    void drawUpgradeMenu(const WorldSnapshot& world) {
+        clearScreen();
+        std::cout << "Choose an upgrade:\n";
+        for (int i = 0; i < 3; ++i) {
+            std::cout << (i + 1) << ". " << GetUpgradeName(world.offered[i]) << "\n";
+        }
+        std::cout << "Press 1, 2, or 3 to select.\n" << std::flush;
+    }
+    //forces the next frame to repaint every cell, call after anything else wrote to the terminal
+    void invalidate() { fullRepaint = true; }
+    //collects frames in memory instead of writing them to the terminal
+    void setSink(std::string* sink_) { sink = sink_; }
+    //also publishes every composed frame there
+    void setBroadcast(FrameBroadcast* broadcast_) { broadcast = broadcast_; }
+    void clearScreen() {
+        invalidate();
+#ifdef _WIN32
+        if (!vtEnabled) {
+            system("cls");
+            return;
+        }
+#endif
+        std::cout << "\033[?25h\033[2J\033[1;1H";
+    }
+
+private:
+    std::vector<char> front, back;
+    std::string out;
+    bool fullRepaint = true;
+    bool useRepeat = true;
+    bool vtEnabled = true;
+    int cursorRow = -1, cursorCol = -1;
+    std::string* sink = nullptr;
+    FrameBroadcast* broadcast = nullptr;
+
+    void put(int row, int col, char c) { back[row * COLS + col] = c; }
+    void text(int row, int col, const char* s) {
+        while (*s && col < COLS) put(row, col++, *s++);
+    }
+    void putArena(int x, int y, char c) { put(ARENA_ROW + 1 + y, 1 + x, c); }
+    void bar(int row, const char* label, int value, int maxValue) {
+        if (value < 0) value = 0;
+        if (value > maxValue) value = maxValue;
+        int length = maxValue > 0 ? (value * GRID_COLS) / maxValue : 0;
+        if (length < 0) length = 0;
+        if (length > GRID_COLS) length = GRID_COLS;
+        text(row, 0, label);
+        put(row, 4, '[');
+        for (int i = 0; i < GRID_COLS; ++i) put(row, 5 + i, i < length ? '#' : ' ');
+        put(row, 5 + GRID_COLS, ']');
+    }
+
+    void compose(const WorldSnapshot& world) {
+        const Player& player = world.player;
+        const int frame = world.frame;
+        std::fill(back.begin(), back.end(), ' ');
+        bar(0, "HP: ", player.hp, player.maxHp);
+        bar(1, "$:  ", player.money, player.maxMoney);
+
+        const int top = ARENA_ROW, bottom = ARENA_ROW + GRID_ROWS + 1;
+        put(top, 0, '+'); put(top, GRID_COLS + 1, '+');
+        put(bottom, 0, '+'); put(bottom, GRID_COLS + 1, '+');
+        for (int x = 1; x <= GRID_COLS; ++x) {
+            put(top, x, '-');
+            put(bottom, x, '-');
+        }
+        for (int y = 1; y <= GRID_ROWS; ++y) {
+            put(top + y, 0, '|');
+            put(top + y, GRID_COLS + 1, '|');
         }
         // Draw player ship
         for (int dy = 0; dy < static_cast<int>(player.shape.size()); ++dy) {
             const std::string& row = player.shape[dy];
             for (int dx = 0; dx < static_cast<int>(row.size()); ++dx) {
                 char c = row[dx];
-                int px = player.x + dx + 1, py = player.y + dy + 1;
-                if (c != ' ' && px >= 1 && px <= GRID_COLS && py >= 1 && py <= GRID_ROWS)
-                    grid[py][px] = c;
-            }
-        }
-        // Draw all enemies
-        for (const auto& enemyPtr : enemies) {
-            if (!enemyPtr->isAlive()) continue;
-            RayEnemy* ray = dynamic_cast<RayEnemy*>(enemyPtr.get());
-            if (ray) {
-                int ex = ray->x + 1, ey = ray->y + 1;
-                if (ey >= 1 && ey <= GRID_ROWS && ex >= 1 && ex <= GRID_COLS)
-                    grid[ey][ex] = '@';
-
-                if (ray->isFlashing()) {
-                    //telegraph with single line cross for clarity
-                    if ((frame / 4) % 2 == 0) {
-                        if (ex >= 1 && ex <= GRID_COLS) {
-                            for (int y = 1; y <= GRID_ROWS; ++y)
-                                grid[y][ex] = '|';
-                        }
-                        if (ey >= 1 && ey <= GRID_ROWS) {
-                            for (int x = 1; x <= GRID_COLS; ++x)
-                                grid[ey][x] = '-';
-                        }
+                int px = player.x + dx, py = player.y + dy;
+                if (c != ' ' && px >= 0 && px < GRID_COLS && py >= 0 && py < GRID_ROWS)
+                    putArena(px, py, c);
+            }
+        }
+        // Draw ray enemies and their crosses, ships are drawn over the lasers
+        for (const RayView& ray : world.rays) {
+            int ex = ray.x, ey = ray.y;
+            bool colVisible = ex >= 0 && ex < GRID_COLS;
+            bool rowVisible = ey >= 0 && ey < GRID_ROWS;
+            if (colVisible && rowVisible)
+                putArena(ex, ey, '@');
+
+            if (ray.state == RayState::Flashing) {
+                //telegraph with single line cross for clarity
+                if ((frame / 4) % 2 == 0) {
+                    if (colVisible) {
+                        for (int y = 0; y < GRID_ROWS; ++y)
+                            putArena(ex, y, '|');
                     }
-                } else if (ray->isFiring()) {
-                    //3 wide cross spanning lazers the entire arena
-                    for (int xoff = -1; xoff <= 1; ++xoff) {
-                        int x = ex + xoff;
-                        if (x < 1 || x > GRID_COLS) continue;
-                        for (int y = 1; y <= GRID_ROWS; ++y)
-                            grid[y][x] = '|';
+                    if (rowVisible) {
+                        for (int x = 0; x < GRID_COLS; ++x)
+                            putArena(x, ey, '-');
                     }
-                    for (int yoff = -1; yoff <= 1; ++yoff) {
-                        int y = ey + yoff;
-                        if (y < 1 || y > GRID_ROWS) continue;
-                        for (int x = 1; x <= GRID_COLS; ++x)
-                            grid[y][x] = '-';
+                }
+            } else if (ray.state == RayState::Firing) {
+                //3 wide cross spanning lazers the entire arena
+                for (int xoff = -1; xoff <= 1; ++xoff) {
+                    int x = ex + xoff;
+                    if (x < 0 || x >= GRID_COLS) continue;
+                    for (int y = 0; y < GRID_ROWS; ++y)
+                        putArena(x, y, '|');
+                }
+                for (int yoff = -1; yoff <= 1; ++yoff) {
+                    int y = ey + yoff;
+                    if (y < 0 || y >= GRID_ROWS) continue;
+                    for (int x = 0; x < GRID_COLS; ++x)
+                        putArena(x, y, '-');
+                }
+            }
+        }
+        // Draw shaped enemies
+        for (const EnemyView& enemy : world.enemies) {
+            const std::vector<std::string>& shape = GetEnemyShape(enemy.kind);
+            for (int dy = 0; dy < static_cast<int>(shape.size()); ++dy) {
+                const std::string& erow = shape[dy];
+                for (int dx = 0; dx < static_cast<int>(erow.size()); ++dx) {
+                    char c = erow[dx];
+                    int ex = enemy.x + dx, ey = enemy.y + dy;
+                    if (c != ' ' && ex >= 0 && ex < GRID_COLS && ey >= 0 && ey < GRID_ROWS)
+                        putArena(ex, ey, c);
+                }
+            }
+        }
+        // Draw bullets
+        for (size_t i = 0; i < world.bulletX.size(); ++i) {
+            int bx = world.bulletX[i], by = world.bulletY[i];
+            if (bx >= 0 && bx < GRID_COLS && by >= 0 && by < GRID_ROWS)
+                putArena(bx, by, world.bulletSymbol[i]);
+        }
+
+        char status[COLS + 1];
+        std::snprintf(status, sizeof(status), "Frame: %d | Use WASD to move, Q to quit", frame);
+        text(ARENA_ROW + GRID_ROWS + 2, 0, status);
+    }
+
+    void appendInt(int v) {
+        char buf[12];
+        int n = std::snprintf(buf, sizeof(buf), "%d", v);
+        out.append(buf, n);
+    }
+    //shortest sequence that puts the cursor on (row, col)
+    void moveCursor(int row, int col) {
+        if (row == cursorRow && col == cursorCol) return;
+        if (row == cursorRow && col > cursorCol) {
+            out += "\033[";
+            if (col - cursorCol > 1) appendInt(col - cursorCol);
+            out += 'C';
+        } else if (row == cursorRow + 1 && col == 0 && cursorRow >= 0) {
+            out += "\r\n";
+        } else {
+            out += "\033[";
+            appendInt(row + 1);
+            out += ';';
+            appendInt(col + 1);
+            out += 'H';
+        }
+        cursorRow = row;
+        cursorCol = col;
+    }
+    //writes back buffer cells [from, to) of a row, long runs of one character use REP
+    void appendCells(int row, int from, int to) {
+        const char* cells = &back[row * COLS];
+        int i = from;
+        while (i < to) {
+            const char c = cells[i];
+            int run = 1;
+            while (i + run < to && cells[i + run] == c) ++run;
+            if (useRepeat && run > 6) {
+                out += c;
+                out += "\033[";
+                appendInt(run - 1);
+                out += 'b';
+            } else {
+                out.append(run, c);
+            }
+            i += run;
+        }
+        cursorCol = to;
+    }
+
+    void present() {
+#ifdef _WIN32
+        if (!vtEnabled) {
+            //no escape sequences available, repaint the old way
+            system("cls");
+            for (int r = 0; r < ROWS; ++r) {
+                std::cout.write(&back[r * COLS], COLS);
+                std::cout << '\n';
+            }
+            std::cout.flush();
+            return;
+        }
+#else
+        if (g_terminalResized) {
+            g_terminalResized = 0;
+            fullRepaint = true;
+        }
+#endif
+        std::cout.flush(); //anything streamed to cout must land before our cells
+        out.clear();
+        if (fullRepaint) {
+            out += "\033[?25l\033[H\033[2J";
+            cursorRow = cursorCol = 0;
+            for (int r = 0; r < ROWS; ++r) {
+                int end = COLS;
+                while (end > 0 && back[r * COLS + end - 1] == ' ') --end;
+                if (end == 0) continue;
+                moveCursor(r, 0);
+                appendCells(r, 0, end);
+            }
+            fullRepaint = false;
+        } else {
+            //a gap this short is cheaper to rewrite than to jump over
+            const int mergeGap = 4;
+            for (int r = 0; r < ROWS; ++r) {
+                const char* f = &front[r * COLS];
+                const char* b = &back[r * COLS];
+                int c = 0;
+                while (c < COLS) {
+                    if (f[c] == b[c]) { ++c; continue; }
+                    int start = c, end = c + 1, gap = 0;
+                    for (int k = end; k < COLS && gap <= mergeGap; ++k) {
+                        if (f[k] != b[k]) {
+                            end = k + 1;
+                            gap = 0;
+                        } else {
+                            ++gap;
+                        }
                     }
+                    moveCursor(r, start);
+                    appendCells(r, start, end);
+                    c = end;
                 }
+            }
+        }
+        front.swap(back);
+        writeOut();
+    }
+
+    void writeOut() {
+        if (out.empty()) return;
+        if (sink) {
+            sink->append(out);
+            return;
+        }
+#ifdef _WIN32
+        DWORD written = 0;
+        if (!WriteFile(GetStdHandle(STD_OUTPUT_HANDLE), out.data(), static_cast<DWORD>(out.size()), &written, nullptr)
+            || written != out.size())
+            fullRepaint = true;
+#else
+        size_t off = 0;
+        while (off < out.size()) {
+            ssize_t n = ::write(STDOUT_FILENO, out.data() + off, out.size() - off);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                fullRepaint = true; //the terminal may hold a partial frame
+                break;
+            }
+            off += static_cast<size_t>(n);
+        }
+#endif
+    }
+};
+
+//single producer single consumer ring, the reader thread pushes and the game loop pops
+template <typename T, size_t N>
+class SpscRing {
+    static_assert((N & (N - 1)) == 0, "ring size must be a power of two");
+    T slots[N];
+    std::atomic<size_t> head{ 0 }; //next slot to read, only the consumer stores it
+    std::atomic<size_t> tail{ 0 }; //next slot to write, only the producer stores it
+public:
+    bool push(const T& value) {
+        const size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N) return false;
+        slots[t & (N - 1)] = value;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+    bool pop(T& value) {
+        const size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        value = slots[h & (N - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+//puts the terminal in raw mode once and drains stdin on a background thread into a ring of raw
+//key bytes, the game loop folds whatever arrived since the last frame into a KeyMask
+class InputManager {
+#ifndef _WIN32
+    struct termios savedTerm;
+    bool termSaved = false;
+    SpscRing<char, 256> events; //raw key bytes
+    std::thread reader;
+    std::atomic<bool> readerDone{ false };
+    int wakePipe[2] = { -1, -1 };
+
+    void readLoop() {
+        char buf[64];
+        struct pollfd fds[2] = { { STDIN_FILENO, POLLIN, 0 }, { wakePipe[0], POLLIN, 0 } };
+        for (;;) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (fds[1].revents) break;
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            for (ssize_t i = 0; i < n; ++i) {
+                if (!events.push(buf[i])) break; //game loop stalled, drop the rest
+            }
+        }
+        readerDone = true;
+    }
+#endif
+public:
+    InputManager() {
+#ifndef _WIN32
+        //echo stays off for the whole session, keys echoed between frames would
+        //land on cells the renderer believes are unchanged
+        if (tcgetattr(STDIN_FILENO, &savedTerm) == 0) {
+            termSaved = true;
+            struct termios t = savedTerm;
+            t.c_lflag &= ~(ICANON | ECHO);
+            t.c_cc[VMIN] = 1;
+            t.c_cc[VTIME] = 0;
+            tcsetattr(STDIN_FILENO, TCSANOW, &t);
+        }
+        if (pipe(wakePipe) == 0) reader = std::thread(&InputManager::readLoop, this);
+        else readerDone = true;
+#endif
+    }
+    ~InputManager() { restore(); }
+    //stops the reader and hands the terminal back in its original mode, e.g. before line based prompts
+    void restore() {
+#ifndef _WIN32
+        if (reader.joinable()) {
+            const char wake = 1;
+            if (write(wakePipe[1], &wake, 1) < 0) {}
+            reader.join();
+            close(wakePipe[0]);
+            close(wakePipe[1]);
+        }
+        if (termSaved) {
+            tcsetattr(STDIN_FILENO, TCSANOW, &savedTerm);
+            termSaved = false;
+        }
+#endif
+    }
+    KeyMask getKeys() {
+        KeyMask keys = 0;
+#ifdef _WIN32
+        if (GetAsyncKeyState('W') & 0x8000) keys |= KeyUp;
+        if (GetAsyncKeyState('A') & 0x8000) keys |= KeyLeft;
+        if (GetAsyncKeyState('S') & 0x8000) keys |= KeyDown;
+        if (GetAsyncKeyState('D') & 0x8000) keys |= KeyRight;
+        if (GetAsyncKeyState('Q') & 0x8000) keys |= KeyQuit;
+        if (GetAsyncKeyState(VK_SPACE) & 0x8000) keys |= KeyFire;
+        if (GetAsyncKeyState('R') & 0x8000) keys |= KeyRewind;
+#else
+        char key;
+        while (events.pop(key)) keys |= KeyBitFor(key);
+#endif
+        return keys;
+    }
+    //blocks until one of the digits 1..count is pressed and returns it zero based
+    int waitForDigit(int count) {
+        for (;;) {
+#ifdef _WIN32
+            int choice = _getch() - '0';
+            if (choice >= 1 && choice <= count) return choice - 1;
+#else
+            char key;
+            while (events.pop(key)) {
+                int choice = key - '0';
+                if (choice >= 1 && choice <= count) return choice - 1;
+            }
+            if (readerDone) return 0; //stdin closed
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+#endif
+        }
+    }
+};
+
+#ifndef DEFFDRED_PROFILE
+#define DEFFDRED_PROFILE 1
+#endif
+
+enum class Phase { Input, Movement, Spawning, Collision, Rays, Upgrades, Snapshot, Render, Count };
+
+static const char* GetPhaseName(Phase phase) {
+    switch (phase) {
+    case Phase::Input:     return "input";
+    case Phase::Movement:  return "movement";
+    case Phase::Spawning:  return "spawning";
+    case Phase::Collision: return "collision";
+    case Phase::Rays:      return "rays";
+    case Phase::Upgrades:  return "upgrades";
+    case Phase::Snapshot:  return "snapshot";
+    case Phase::Render:    return "render";
+    default:               return "unknown";
+    }
+}
+
+//log2 buckets of nanoseconds split into 4 linear steps each, so quantiles are within 25%
+class LatencyHistogram {
+    static constexpr int SUB_BUCKETS = 4;
+    static constexpr int BUCKETS = 64 * SUB_BUCKETS;
+    unsigned long long counts[BUCKETS] = {};
+    unsigned long long total = 0;
+    unsigned long long maxNs = 0;
+
+    static int bucketOf(unsigned long long ns) {
+        if (ns < SUB_BUCKETS) return static_cast<int>(ns);
+        int msb = 63;
+        while (!(ns >> msb)) --msb;
+        const int sub = static_cast<int>((ns >> (msb - 2)) & (SUB_BUCKETS - 1));
+        return msb * SUB_BUCKETS + sub;
+    }
+    static unsigned long long upperBound(int bucket) {
+        if (bucket < SUB_BUCKETS) return bucket;
+        const int msb = bucket / SUB_BUCKETS, sub = bucket % SUB_BUCKETS;
+        return ((static_cast<unsigned long long>(SUB_BUCKETS + sub + 1)) << (msb - 2)) - 1;
+    }
+public:
+    void record(unsigned long long ns) {
+        counts[bucketOf(ns)]++;
+        total++;
+        if (ns > maxNs) maxNs = ns;
+    }
+    void merge(const LatencyHistogram& other) {
+        for (int i = 0; i < BUCKETS; ++i) counts[i] += other.counts[i];
+        total += other.total;
+        if (other.maxNs > maxNs) maxNs = other.maxNs;
+    }
+    unsigned long long count() const { return total; }
+    unsigned long long max() const { return maxNs; }
+    //upper edge of the bucket holding the requested quantile, capped at the observed max
+    unsigned long long percentile(double p) const {
+        if (total == 0) return 0;
+        unsigned long long rank = static_cast<unsigned long long>(p * (total - 1)) + 1;
+        unsigned long long seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank) return std::min(upperBound(i), maxNs);
+        }
+        return maxNs;
+    }
+};
+
+//per phase and whole frame latency histograms plus a count of frames that overran FRAME_MS
+class FrameProfiler {
+public:
+    LatencyHistogram phases[static_cast<int>(Phase::Count)];
+    LatencyHistogram frames;
+    unsigned long long lastNs[static_cast<int>(Phase::Count)] = {};
+    unsigned long long overruns = 0;
+#if DEFFDRED_COUNT_ALLOCS
+    //operator new calls between consecutive endFrame calls, render thread included
+    unsigned long long allocs = 0, allocBytes = 0, allocatingFrames = 0, maxFrameAllocs = 0, allocFrames = 0;
+    unsigned long long seenAllocs = 0, seenBytes = 0;
+#endif
+
+    //allocations before this (loading, first spawns) are not charged to the first frame
+    void startFrames() {
+#if DEFFDRED_COUNT_ALLOCS
+        seenAllocs = g_allocCount.load(std::memory_order_relaxed);
+        seenBytes = g_allocBytes.load(std::memory_order_relaxed);
+#endif
+    }
+    void add(Phase phase, unsigned long long ns) {
+        lastNs[static_cast<int>(phase)] += ns;
+    }
+    //closes the frame, frames spent waiting on the upgrade menu are left out of the totals
+    void endFrame(unsigned long long frameNs, bool waitedOnPlayer) {
+        for (int i = 0; i < static_cast<int>(Phase::Count); ++i) {
+            if (i == static_cast<int>(Phase::Render)) continue; //timed on the render thread and merged in later
+            if (!waitedOnPlayer || i == static_cast<int>(Phase::Upgrades)) phases[i].record(lastNs[i]);
+            lastNs[i] = 0;
+        }
+#if DEFFDRED_COUNT_ALLOCS
+        const unsigned long long nowAllocs = g_allocCount.load(std::memory_order_relaxed);
+        const unsigned long long nowBytes = g_allocBytes.load(std::memory_order_relaxed);
+        const unsigned long long frameAllocs = nowAllocs - seenAllocs;
+        allocs += frameAllocs;
+        allocBytes += nowBytes - seenBytes;
+        allocFrames++;
+        if (frameAllocs) allocatingFrames++;
+        maxFrameAllocs = std::max(maxFrameAllocs, frameAllocs);
+        seenAllocs = nowAllocs;
+        seenBytes = nowBytes;
+#endif
+        if (waitedOnPlayer) return;
+        frames.record(frameNs);
+        if (frameNs > static_cast<unsigned long long>(FRAME_MS) * 1000000ull) overruns++;
+    }
+    void overlayLine(char* buf, size_t size) const {
+        const int n = std::snprintf(buf, size, "frame us p50 %llu p99 %llu max %llu | overruns %llu",
+            frames.percentile(0.5) / 1000, frames.percentile(0.99) / 1000, frames.max() / 1000, overruns);
+#if DEFFDRED_COUNT_ALLOCS
+        if (n > 0 && static_cast<size_t>(n) < size)
+            std::snprintf(buf + n, size - n, " | allocating frames %llu", allocatingFrames);
+#else
+        (void)n;
+#endif
+    }
+#if DEFFDRED_COUNT_ALLOCS
+    void allocLine(char* buf, size_t size) const {
+        std::snprintf(buf, size, "allocs %llu (%llu bytes) over %llu frames, %.2f per frame, %llu frames allocated, max %llu",
+            allocs, allocBytes, allocFrames, allocFrames ? static_cast<double>(allocs) / allocFrames : 0.0,
+            allocatingFrames, maxFrameAllocs);
+    }
+#endif
+    bool writeCsv(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out) return false;
+        out << "phase,count,p50_ns,p99_ns,max_ns\n";
+        for (int i = 0; i < static_cast<int>(Phase::Count); ++i) {
+            const LatencyHistogram& h = phases[i];
+            out << GetPhaseName(static_cast<Phase>(i)) << ',' << h.count() << ',' << h.percentile(0.5) << ','
+                << h.percentile(0.99) << ',' << h.max() << '\n';
+        }
+        out << "frame," << frames.count() << ',' << frames.percentile(0.5) << ',' << frames.percentile(0.99) << ','
+            << frames.max() << '\n';
+        return true;
+    }
+    bool writeJson(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out) return false;
+        out << "{\n  \"frame_ms\": " << FRAME_MS << ",\n  \"overruns\": " << overruns << ",\n  \"phases\": {\n";
+        for (int i = 0; i <= static_cast<int>(Phase::Count); ++i) {
+            const bool isFrame = i == static_cast<int>(Phase::Count);
+            const LatencyHistogram& h = isFrame ? frames : phases[i];
+            out << "    \"" << (isFrame ? "frame" : GetPhaseName(static_cast<Phase>(i))) << "\": {\"count\": " << h.count()
+                << ", \"p50_ns\": " << h.percentile(0.5) << ", \"p99_ns\": " << h.percentile(0.99)
+                << ", \"max_ns\": " << h.max() << "}" << (isFrame ? "\n" : ",\n");
+        }
+        out << "  }";
+#if DEFFDRED_COUNT_ALLOCS
+        out << ",\n  \"allocations\": {\"count\": " << allocs << ", \"bytes\": " << allocBytes
+            << ", \"allocating_frames\": " << allocatingFrames << ", \"max_per_frame\": " << maxFrameAllocs << "}";
+#endif
+        out << "\n}\n";
+        return true;
+    }
+};
+
+class ScopedPhaseTimer {
+    FrameProfiler& profiler;
+    Phase phase;
+    std::chrono::steady_clock::time_point start;
+public:
+    ScopedPhaseTimer(FrameProfiler& profiler_, Phase phase_)
+        : profiler(profiler_), phase(phase_), start(std::chrono::steady_clock::now()) {
+    }
+    ~ScopedPhaseTimer() {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        profiler.add(phase, static_cast<unsigned long long>(ns));
+    }
+};
+
+//PROFILE_PHASE times the rest of the enclosing block, with DEFFDRED_PROFILE=0 it and the profiler vanish
+#if DEFFDRED_PROFILE
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#define PROFILE_PHASE(phase) ScopedPhaseTimer PROFILE_CONCAT(phaseTimer, __LINE__)(profiler, phase)
+#else
+#define PROFILE_PHASE(phase) ((void)0)
+#endif
+
+class InputSource {
+public:
+    virtual ~InputSource() {}
+    virtual KeyMask getKeys(int frame) = 0;
+    //index into the offered upgrades, called while the upgrade menu is up
+    virtual int chooseUpgrade(int optionCount) = 0;
+    //hands the terminal back before line based prompts
+    virtual void restore() {}
+};
+
+class TerminalInput : public InputSource {
+    InputManager manager;
+public:
+    KeyMask getKeys(int) override { return manager.getKeys(); }
+    int chooseUpgrade(int optionCount) override { return manager.waitForDigit(optionCount); }
+    void restore() override { manager.restore(); }
+};
+
+//never presses anything and always takes the first upgrade
+class NullInput : public InputSource {
+public:
+    KeyMask getKeys(int) override { return 0; }
+    int chooseUpgrade(int) override { return 0; }
+};
+
+//plays keys back from a script, one "<frame> <keys>" line per change in held keys
+//('_' is space, '-' is nothing held) plus "pick <n>" lines consumed by successive upgrade menus
+class ScriptedInput : public InputSource {
+    std::vector<std::pair<int, KeyMask>> changes;
+    std::vector<int> picks;
+    size_t nextChange = 0;
+    size_t nextPick = 0;
+    KeyMask held = 0;
+    int scriptFrame = 0;
+    int lastFrame = 0;
+public:
+    explicit ScriptedInput(const std::string& filename) {
+        std::ifstream file(filename);
+        if (!file) throw std::runtime_error("Input script not found");
+        std::string line;
+        int lastFrame = -1;
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') continue;
+            std::istringstream iss(line);
+            std::string first, keys;
+            if (!(iss >> first)) continue;
+            if (first == "pick") {
+                int n = 0;
+                if (!(iss >> n) || n < 1) throw std::runtime_error("Invalid pick in input script");
+                picks.push_back(n - 1);
                 continue;
             }
-            for (int dy = 0; dy < static_cast<int>(enemyPtr->shape.size()); ++dy) {
-                const std::string& erow = enemyPtr->shape[dy];
-                for (int dx = 0; dx < static_cast<int>(erow.size()); ++dx) { // FIX: ++dx
-                    char c = erow[dx];
-                    int ex2 = enemyPtr->x + dx + 1, ey2 = enemyPtr->y + dy + 1;
-                    if (c != ' ' && ex2 >= 1 && ex2 <= GRID_COLS && ey2 >= 1 && ey2 <= GRID_ROWS)
-                        grid[ey2][ex2] = c;
+            int frame = 0;
+            try {
+                frame = std::stoi(first);
+            } catch (...) {
+                throw std::runtime_error("Invalid frame in input script");
+            }
+            if (frame < lastFrame) throw std::runtime_error("Input script frames out of order");
+            lastFrame = frame;
+            iss >> keys;
+            KeyMask mask = 0;
+            for (char c : keys) mask |= KeyBitFor(c == '_' ? ' ' : c);
+            changes.emplace_back(frame, mask);
+        }
+    }
+    //script time follows the game frame, except that a step spent rewinding moves it on by one
+    //instead of back, so a held r is released when the script says
+    KeyMask getKeys(int frame) override {
+        scriptFrame += (held & KeyRewind) ? 1 : frame - lastFrame;
+        lastFrame = frame;
+        while (nextChange < changes.size() && changes[nextChange].first <= scriptFrame)
+            held = changes[nextChange++].second;
+        return held;
+    }
+    int chooseUpgrade(int optionCount) override {
+        int pick = nextPick < picks.size() ? picks[nextPick++] : 0;
+        return pick < optionCount ? pick : 0;
+    }
+};
+
+//a stand in player for batch runs: holds a random direction for a random stretch, fires most
+//of the time and picks upgrades at random, all from its own generator
+class RandomInput : public InputSource {
+    std::mt19937 rng;
+    KeyMask held = 0;
+    int holdUntil = 0;
+public:
+    explicit RandomInput(std::mt19937 rng_) : rng(rng_) {}
+    KeyMask getKeys(int frame) override {
+        if (frame >= holdUntil) {
+            static const KeyMask moves[] = { 0, KeyUp, KeyDown, KeyLeft, KeyRight,
+                                             KeyUp | KeyLeft, KeyUp | KeyRight, KeyDown | KeyLeft, KeyDown | KeyRight };
+            std::uniform_int_distribution<int> moveDist(0, 8), holdDist(3, 30), fireDist(0, 3);
+            held = moves[moveDist(rng)];
+            if (fireDist(rng) != 0) held |= KeyFire;
+            holdUntil = frame + holdDist(rng);
+        }
+        return held;
+    }
+    int chooseUpgrade(int optionCount) override {
+        std::uniform_int_distribution<int> pick(0, optionCount - 1);
+        return pick(rng);
+    }
+};
+
+//what the autopilot reads of the world, references into the game that owns it
+struct AutopilotView {
+    const Player& player;
+    const BulletPool& bullets;
+    const EnemyStore& enemies;
+    const std::vector<UpgradeType>& offeredUpgrades;
+    const int& tick;
+    const Arena& arena;
+};
+
+//plays by looking HORIZON frames ahead: hostile bullets are projected along dx/dy into a danger map
+//of the window the ship can reach, rays add their cross for the frames it will be live, and of the
+//moves held for the whole horizon or tapped once the cheapest wins, with fire always held.
+//keys depend on the world alone, so a recorded autopilot run replays like any other
+class AutopilotInput : public InputSource {
+public:
+    static constexpr int HORIZON = 8;
+    static constexpr int MAX_REACH = 32; //window radius cap, a faster ship sees nothing beyond it
+    static constexpr float DEATH = 1e6f;
+
+    explicit AutopilotInput(const AutopilotView& view_)
+        : view(view_), danger(HORIZON * (2 * MAX_REACH + 3) * (2 * MAX_REACH + 3)) {}
+
+    KeyMask getKeys(int) override {
+        static const KeyMask moves[] = { 0, KeyUp, KeyDown, KeyLeft, KeyRight,
+                                         KeyUp | KeyLeft, KeyUp | KeyRight, KeyDown | KeyLeft, KeyDown | KeyRight };
+        const Player& player = view.player;
+        reach = std::min(MAX_REACH, HORIZON * std::max(1, player.moveSpeed) + 2);
+        side = 2 * reach + 3;
+        originX = player.x - reach;
+        originY = player.y - reach;
+        markBullets();
+        const int target = targetColumn();
+
+        KeyMask best = 0;
+        float bestCost = std::numeric_limits<float>::max();
+        for (const KeyMask move : moves) {
+            for (const int held : { HORIZON, 1 }) {
+                if (held == 1 && move == 0) continue;
+                const float cost = planCost(move, held, target);
+                if (cost < bestCost) { bestCost = cost; best = move; }
+            }
+        }
+        return static_cast<KeyMask>(best | KeyFire);
+    }
+
+    //hp when running low, otherwise fire rate: the spawn ramp outgrows a slow gun long before it
+    //outgrows the hp pool. extra streams past three and move speed past two drop to the back
+    int chooseUpgrade(int optionCount) override {
+        const Player& player = view.player;
+        int best = 0, bestRank = std::numeric_limits<int>::max();
+        for (int i = 0; i < optionCount && i < static_cast<int>(view.offeredUpgrades.size()); ++i) {
+            int rank;
+            switch (view.offeredUpgrades[i]) {
+            case UpgradeType::IncreaseHP:    rank = player.hp * 2 <= player.maxHp ? 0 : 4; break;
+            case UpgradeType::AttackSpeed:   rank = 1; break;
+            case UpgradeType::LifeSteal:     rank = 2; break;
+            case UpgradeType::BulletsAmount: rank = player.bulletStreams < 3 ? 3 : 6; break;
+            case UpgradeType::Damage:        rank = 7; break;
+            case UpgradeType::MoveSpeed:     rank = player.moveSpeed < 2 ? 8 : 9; break;
+            default:                         rank = 9; break;
+            }
+            if (rank < bestRank) { bestRank = rank; best = i; }
+        }
+        return best;
+    }
+
+private:
+    AutopilotView view;
+    std::vector<float> danger; //damage landing on each window cell in frame t + 1, HORIZON layers
+    int reach = 0, side = 0, originX = 0, originY = 0;
+
+    float* layer(int t) { return danger.data() + static_cast<size_t>(t) * side * side; }
+
+    //every cell each hostile bullet crosses over the horizon, on the layer of the frame it crosses it
+    void markBullets() {
+        std::fill(danger.begin(), danger.begin() + static_cast<size_t>(HORIZON) * side * side, 0.0f);
+        const BulletPool& b = view.bullets;
+        for (size_t i = 0; i < b.size(); ++i) {
+            if (b.owner[i] != BulletOwner::Enemy) continue;
+            int x = b.x[i], y = b.y[i];
+            const int dx = b.dx[i], dy = b.dy[i];
+            const int endX = x + dx * HORIZON, endY = y + dy * HORIZON;
+            if (std::max(x, endX) < originX || std::min(x, endX) >= originX + side ||
+                std::max(y, endY) < originY || std::min(y, endY) >= originY + side) continue;
+            const float damage = b.symbol[i] == 'O' ? 3.0f : 1.0f;
+            for (int t = 0; t < HORIZON; ++t) {
+                float* cells = layer(t);
+                const auto mark = [&](int cx, int cy) {
+                    const int wx = cx - originX, wy = cy - originY;
+                    if (wx >= 0 && wx < side && wy >= 0 && wy < side) cells[wy * side + wx] += damage;
+                    return false;
+                };
+                if (dx == 0 && dy == 0) mark(x, y);
+                else BulletPool::SweepStep(x, y, dx, dy, mark);
+                x += dx;
+                y += dy;
+            }
+        }
+    }
+
+    //centre column of the enemy above the ship that is closest sideways, -1 when there is none
+    int targetColumn() const {
+        const Player& player = view.player;
+        int target = -1, bestGap = std::numeric_limits<int>::max();
+        const auto consider = [&](const EnemyBatch& batch, int centre) {
+            for (size_t i = 0; i < batch.size(); ++i) {
+                if (batch.y[i] >= player.y) continue;
+                const int gap = std::abs(batch.x[i] + centre - (player.x + 1));
+                if (gap < bestGap) { bestGap = gap; target = batch.x[i] + centre; }
+            }
+        };
+        consider(view.enemies.basics, 0);
+        consider(view.enemies.bosses, 1);
+        consider(view.enemies.rays, 0);
+        return target;
+    }
+
+    //damage the ship at (px, py) takes in frame t + 1 from rays, DEATH on a core; crosses that fire
+    //later than the horizon still cost a little so the ship starts leaving while they flash
+    float rayCost(int t, int px, int py) const {
+        const RayBatch& rays = view.enemies.rays;
+        float cost = 0.0f;
+        for (size_t i = 0; i < rays.size(); ++i) {
+            if (rays.state[i] == RayState::Cooldown) continue;
+            const int ex = rays.x[i], ey = rays.y[i];
+            const bool core = (px == ex && std::abs(py - ey) <= 3) || (py == ey && std::abs(px - ex) <= 8);
+            //the ship's rows against the ray's, its columns against the ray's, for the " A "/"/V\" mask
+            const bool cross = (py >= ey - 2 && py <= ey + 1) || (px >= ex - 3 && px <= ex + 1);
+            if (!core && !cross) continue;
+            //frames from now the cross is live, with a frame of margin either side
+            const int left = rays.stateEndTick[i] - view.tick;
+            const bool firing = rays.state[i] == RayState::Firing;
+            const int from = firing ? 0 : left - 1, to = firing ? left : left + RayBatch::FIRE_FRAMES;
+            if (t + 1 < from) {
+                cost += core ? 2.0f : 0.25f;
+                continue;
+            }
+            if (t + 1 > to) continue;
+            if (core) return DEATH;
+            if (!(firing && rays.playerDamagedThisFire[i])) cost += RayBatch::DAMAGE;
+        }
+        return cost;
+    }
+
+    //move held for the first held frames and then let go; damage that adds up to the ship's hp costs
+    //DEATH, less the later it happens, and the last position is drawn under the target and to home row
+    float planCost(KeyMask move, int held, int target) {
+        const Player& player = view.player;
+        Player ship = player;
+        float damage = 0.0f;
+        for (int t = 0; t < HORIZON; ++t) {
+            ship.move(t < held ? move : 0, view.arena);
+            const int wx = ship.x - originX, wy = ship.y - originY;
+            if (wx >= 0 && wx + 2 < side && wy >= 0 && wy + 1 < side) {
+                const float* cells = layer(t);
+                damage += cells[wy * side + wx + 1] + cells[(wy + 1) * side + wx] +
+                          cells[(wy + 1) * side + wx + 1] + cells[(wy + 1) * side + wx + 2];
+            }
+            const float rays = rayCost(t, ship.x, ship.y);
+            if (rays >= DEATH) return DEATH * (HORIZON - t);
+            damage += rays;
+            if (damage >= player.hp) return DEATH * (HORIZON - t);
+        }
+        float cost = damage;
+        if (target >= 0) cost += 0.05f * std::abs(ship.x + 1 - target);
+        cost += 0.02f * std::abs(ship.y - (view.arena.rows - 4));
+        return cost;
+    }
+};
+
+constexpr int AutopilotInput::HORIZON;
+constexpr int AutopilotInput::MAX_REACH;
+constexpr float AutopilotInput::DEATH;
+
+//exclusive lock held on a lock file for the object's lifetime, waits for other processes holding it
+class FileLock {
+#ifdef _WIN32
+    HANDLE handle = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+    bool held = false;
+public:
+    explicit FileLock(const std::string& path) {
+#ifdef _WIN32
+        handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                             nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (handle == INVALID_HANDLE_VALUE) return;
+        OVERLAPPED overlapped = {};
+        held = LockFileEx(handle, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped) != 0;
+#else
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) return;
+        struct flock fl = {};
+        fl.l_type = F_WRLCK;
+        fl.l_whence = SEEK_SET;
+        int rc;
+        do {
+            rc = fcntl(fd, F_SETLKW, &fl);
+        } while (rc == -1 && errno == EINTR);
+        held = rc == 0;
+#endif
+    }
+    FileLock(const FileLock&) = delete;
+    FileLock& operator=(const FileLock&) = delete;
+    ~FileLock() {
+#ifdef _WIN32
+        if (handle == INVALID_HANDLE_VALUE) return;
+        if (held) {
+            OVERLAPPED overlapped = {};
+            UnlockFileEx(handle, 0, MAXDWORD, MAXDWORD, &overlapped);
+        }
+        CloseHandle(handle);
+#else
+        if (fd >= 0) ::close(fd); //releases the lock
+#endif
+    }
+    bool locked() const { return held; }
+};
+
+//replaces dst with src in one step so readers see the old or the new file, never half of one
+static bool ReplaceFileAtomically(const std::string& src, const std::string& dst) {
+#ifdef _WIN32
+    return MoveFileExA(src.c_str(), dst.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    return std::rename(src.c_str(), dst.c_str()) == 0;
+#endif
+}
+
+struct ScoreEntry {
+    int score;
+    std::string name;
+};
+
+//scores appended one "score<TAB>name" line each to the log, with the best few kept in an index file
+//that records how many log bytes it has seen; recording a score reads only the index and whatever
+//the log gained since, so game over costs the same with ten entries or a million. Once the log passes
+//compactBytes it is moved onto the archive and restarted with just the kept entries
+class Leaderboard {
+    std::string logPath, indexPath, lockPath, archivePath;
+    size_t keep;
+    long long compactBytes;
+
+    static constexpr const char* INDEX_MAGIC = "DDTOP1";
+
+    static bool parseLine(const std::string& line, ScoreEntry& entry) {
+        const size_t sep = line.find('\t');
+        if (sep == std::string::npos || sep == 0) return false;
+        char* end = nullptr;
+        errno = 0;
+        const long value = std::strtol(line.c_str(), &end, 10);
+        if (end != line.c_str() + sep || errno == ERANGE || value < std::numeric_limits<int>::min()
+            || value > std::numeric_limits<int>::max()) return false;
+        entry.score = static_cast<int>(value);
+        entry.name = line.substr(sep + 1);
+        if (!entry.name.empty() && entry.name.back() == '\r') entry.name.pop_back();
+        return true;
+    }
+
+    static long long fileSize(const std::string& path) {
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        return in ? static_cast<long long>(in.tellg()) : 0;
+    }
+
+    //equal scores rank in the order they were recorded
+    void insert(std::vector<ScoreEntry>& top, const ScoreEntry& entry) const {
+        auto at = std::upper_bound(top.begin(), top.end(), entry.score,
+            [](int score, const ScoreEntry& e) { return score > e.score; });
+        if (static_cast<size_t>(at - top.begin()) >= keep) return;
+        top.insert(at, entry);
+        if (top.size() > keep) top.pop_back();
+    }
+
+    bool readIndex(std::vector<ScoreEntry>& top, long long& covered) const {
+        std::ifstream in(indexPath, std::ios::binary);
+        std::string magic;
+        if (!(in >> magic >> covered) || magic != INDEX_MAGIC || covered < 0) return false;
+        std::string line;
+        std::getline(in, line);
+        while (std::getline(in, line)) {
+            ScoreEntry entry;
+            if (parseLine(line, entry)) insert(top, entry);
+        }
+        return true;
+    }
+
+    bool writeIndex(const std::vector<ScoreEntry>& top, long long covered) const {
+        const std::string tmp = indexPath + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out) return false;
+            out << INDEX_MAGIC << ' ' << covered << '\n';
+            for (const ScoreEntry& e : top) out << e.score << '\t' << e.name << '\n';
+            if (!out.flush()) return false;
+        }
+        return ReplaceFileAtomically(tmp, indexPath);
+    }
+
+    //folds log lines from byte covered on into top, returns the new covered offset;
+    //endsWithNewline tells whether the next append can go straight after it
+    long long catchUp(std::vector<ScoreEntry>& top, long long covered, bool& endsWithNewline) const {
+        endsWithNewline = true;
+        std::ifstream in(logPath, std::ios::binary);
+        if (!in) return 0;
+        in.seekg(covered);
+        std::string line;
+        while (std::getline(in, line)) {
+            ScoreEntry entry;
+            if (parseLine(line, entry)) insert(top, entry);
+            if (in.eof()) endsWithNewline = line.empty();
+        }
+        return fileSize(logPath);
+    }
+
+    //moves every log line but the top entries to the archive and restarts the log from those, so
+    //archive and log together hold each score once however many times the log is compacted
+    bool compact(const std::vector<ScoreEntry>& top, long long& covered) const {
+        {
+            std::ifstream in(logPath, std::ios::binary);
+            std::ofstream archive(archivePath, std::ios::binary | std::ios::app);
+            if (!in || !archive) return false;
+            //equal entries are interchangeable, so each top entry claims the first line that matches it
+            std::vector<ScoreEntry> unclaimed = top;
+            std::string line;
+            while (std::getline(in, line)) {
+                ScoreEntry entry;
+                if (parseLine(line, entry)) {
+                    auto match = std::find_if(unclaimed.begin(), unclaimed.end(),
+                        [&](const ScoreEntry& e) { return e.score == entry.score && e.name == entry.name; });
+                    if (match != unclaimed.end()) {
+                        unclaimed.erase(match);
+                        continue;
+                    }
                 }
+                archive << line << '\n';
             }
+            if (!archive.flush()) return false;
         }
-        // Draw bullets
-        for (const auto& b : bullets) {
-            int bx = b->x + 1, by = b->y + 1;
-            if (bx >= 1 && bx <= GRID_COLS && by >= 1 && by <= GRID_ROWS)
-                grid[by][bx] = b->symbol;
+        const std::string tmp = logPath + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if (!out) return false;
+            for (const ScoreEntry& e : top) out << e.score << '\t' << e.name << '\n';
+            if (!out.flush()) return false;
         }
-        for (const auto& row : grid)
-            std::cout << row << '\n';
+        if (!ReplaceFileAtomically(tmp, logPath)) return false;
+        covered = fileSize(logPath);
+        return true;
     }
-    void clearScreen() {
-#ifdef _WIN32
-        system("cls");
-#else
-        std::cout << "\033[2J\033[1;1H";
-#endif
+
+public:
+    explicit Leaderboard(const std::string& logPath_, size_t keep_ = 10, long long compactBytes_ = 1 << 20)
+        : logPath(logPath_), indexPath(logPath_ + ".top"), lockPath(logPath_ + ".lock"),
+          archivePath(logPath_ + ".archive"), keep(keep_), compactBytes(compactBytes_) {}
+
+    //appends a score under the lock and fills top with the best entries including it
+    bool record(int score, const std::string& name, std::vector<ScoreEntry>& top, std::string& why) {
+        FileLock lock(lockPath);
+        if (!lock.locked()) { why = "could not lock " + lockPath; return false; }
+
+        top.clear();
+        long long covered = 0;
+        //a log shorter than the index remembers was replaced behind our back, start over from it
+        if (!readIndex(top, covered) || covered > fileSize(logPath)) {
+            top.clear();
+            covered = 0;
+        }
+        bool endsWithNewline = true;
+        covered = catchUp(top, covered, endsWithNewline);
+
+        {
+            std::ofstream out(logPath, std::ios::binary | std::ios::app);
+            if (!out) { why = "could not open " + logPath + " for writing"; return false; }
+            if (!endsWithNewline) out << '\n';
+            out << score << '\t' << name << '\n';
+            if (!out.flush()) { why = "could not write " + logPath; return false; }
+        }
+        insert(top, ScoreEntry{ score, name });
+        covered = fileSize(logPath);
+
+        if (covered > compactBytes && !compact(top, covered)) why = "could not compact " + logPath;
+        if (!writeIndex(top, covered)) { why = "could not write " + indexPath; return false; }
+        return true;
     }
 };
 
-class InputManager {
+//the numbers balance tuning turns, defaults are the shipped game
+struct BalanceParams {
+    int basicSpawnInterval = 83;   //frames between basic enemy spawns before the ramp
+    int raySpawnInterval = 100;    //frames between ray enemy spawns before the ramp
+    int rampStartFrame = 1500;     //spawn intervals shrink after this frame
+    int rampStepFrames = 100;      //by rampFactor once per this many frames
+    double rampFactor = 0.925;
+    int bossFirstFrame = 2250;
+    int bossEveryFrames = 500;
+    int hpPerUpgrade = 5;
+    double fireCooldownFactor = 0.8; //attack speed upgrade multiplies the cooldown by this
+    int damagePerUpgrade = 5;
+    int lifeStealPerUpgrade = 5;
+
+    //"name value" lines, # comments; unknown names are an error so typos do not silently tune nothing
+    void load(const std::string& path) {
+        std::ifstream file(path);
+        if (!file) throw std::runtime_error("Balance file not found");
+        read(file);
+    }
+    void read(std::istream& in) {
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream iss(line);
+            std::string name, value;
+            if (!(iss >> name) || name[0] == '#') continue;
+            if (!(iss >> value)) throw std::runtime_error("Missing value for " + name);
+            set(name, value);
+        }
+    }
+    void set(const std::string& name, const std::string& value) {
+        try {
+            for (const IntField& f : intFields()) {
+                if (name == f.name) { this->*f.field = std::stoi(value); return; }
+            }
+            for (const RealField& f : realFields()) {
+                if (name == f.name) { this->*f.field = std::stod(value); return; }
+            }
+        } catch (const std::exception&) {
+            throw std::runtime_error("Bad value for " + name);
+        }
+        throw std::runtime_error("Unknown balance parameter " + name);
+    }
+    //every parameter in the format load reads, reals written so they read back exactly
+    std::string describe() const {
+        std::ostringstream out;
+        out.precision(17);
+        for (const IntField& f : intFields()) out << f.name << " " << this->*f.field << "\n";
+        for (const RealField& f : realFields()) out << f.name << " " << this->*f.field << "\n";
+        return out.str();
+    }
+
+private:
+    struct IntField { const char* name; int BalanceParams::* field; };
+    struct RealField { const char* name; double BalanceParams::* field; };
+    static const std::vector<IntField>& intFields() {
+        static const std::vector<IntField> ints = {
+            { "basic_spawn_interval", &BalanceParams::basicSpawnInterval },
+            { "ray_spawn_interval", &BalanceParams::raySpawnInterval },
+            { "ramp_start_frame", &BalanceParams::rampStartFrame },
+            { "ramp_step_frames", &BalanceParams::rampStepFrames },
+            { "boss_first_frame", &BalanceParams::bossFirstFrame },
+            { "boss_every_frames", &BalanceParams::bossEveryFrames },
+            { "hp_per_upgrade", &BalanceParams::hpPerUpgrade },
+            { "damage_per_upgrade", &BalanceParams::damagePerUpgrade },
+            { "life_steal_per_upgrade", &BalanceParams::lifeStealPerUpgrade },
+        };
+        return ints;
+    }
+    static const std::vector<RealField>& realFields() {
+        static const std::vector<RealField> reals = {
+            { "ramp_factor", &BalanceParams::rampFactor },
+            { "fire_cooldown_factor", &BalanceParams::fireCooldownFactor },
+        };
+        return reals;
+    }
+};
+
+//one kind's spawn interval over the game: the base until rampStartFrame, then multiplied by
+//rampFactor once per rampStepFrames, rounded and at least 1; products are kept in the order they
+//were multiplied so every interval matches the running product exactly
+class SpawnRamp {
+    int base, start, step;
+    double factor;
+    std::vector<double> products; //products[k] is base after k ramp steps
+
 public:
-    std::set<char> getInputs() {
-        std::set<char> inputs;
-#ifdef _WIN32
-        if (GetAsyncKeyState('W') & 0x8000) inputs.insert('w');
-        if (GetAsyncKeyState('A') & 0x8000) inputs.insert('a');
-        if (GetAsyncKeyState('S') & 0x8000) inputs.insert('s');
-        if (GetAsyncKeyState('D') & 0x8000) inputs.insert('d');
-        if (GetAsyncKeyState('Q') & 0x8000) inputs.insert('q');
-        if (GetAsyncKeyState(VK_SPACE) & 0x8000) inputs.insert(' ');
-#else
-        struct termios oldt, newt;
-        tcgetattr(STDIN_FILENO, &oldt);
-        newt = oldt;
-        newt.c_lflag &= ~(ICANON | ECHO);
-        tcsetattr(STDIN_FILENO, TCSANOW, &newt);
-        int bytesWaiting;
-        ioctl(STDIN_FILENO, FIONREAD, &bytesWaiting);
-        while (bytesWaiting-- > 0) {
-            char ch = 0;
-            read(STDIN_FILENO, &ch, 1);
-            if (ch == 'w' || ch == 'a' || ch == 's' || ch == 'd' || ch == 'q' || ch == ' ')
-                inputs.insert(ch);
+    SpawnRamp(int base_, const BalanceParams& balance)
+        : base(base_), start(balance.rampStartFrame), step(balance.rampStepFrames), factor(balance.rampFactor) {
+        products.reserve(1024);
+        products.push_back(static_cast<double>(base));
+    }
+
+    int intervalAt(int frame) {
+        const int over = frame - start;
+        if (over <= 0 || step <= 0) return base;
+        const size_t steps = static_cast<size_t>(over / step);
+        while (products.size() <= steps) products.push_back(products.back() * factor);
+        return std::max(1, static_cast<int>(products[steps] + 0.5));
+    }
+
+    //the first frame after last at which the interval since last has run out, INT_MAX if never;
+    //walks whole ramp steps since the interval only changes at their edges
+    int nextAfter(int last) {
+        int frame = last + 1;
+        for (;;) {
+            const int64_t due = static_cast<int64_t>(last) + intervalAt(frame);
+            if (due <= frame) return frame;
+            const int over = frame - start;
+            int64_t stepEnd = std::numeric_limits<int>::max();
+            if (step > 0) stepEnd = over <= 0 ? start : start + (static_cast<int64_t>(over / step) + 1) * step - 1;
+            if (due <= stepEnd) return static_cast<int>(due);
+            if (stepEnd >= std::numeric_limits<int>::max()) return std::numeric_limits<int>::max();
+            frame = static_cast<int>(stepEnd) + 1;
         }
-        tcsetattr(STDIN_FILENO, TCSANOW, &oldt);
-#endif
-        return inputs;
     }
 };
 
+static void PutVarint(std::vector<unsigned char>& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<unsigned char>(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<unsigned char>(v));
+}
+
+static uint64_t GetVarint(const unsigned char*& p, const unsigned char* end) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (p == end) throw std::runtime_error("Replay truncated");
+        const unsigned char byte = *p++;
+        v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) return v;
+    }
+    throw std::runtime_error("Replay varint too long");
+}
+
+static const char REPLAY_MAGIC[4] = { 'D', 'D', 'R', 'P' };
+//2: enemies draw from counter based generators, 3: arena size, 4: slow bullets dropped as they leave
+constexpr uint16_t REPLAY_VERSION = 4;
+
+//everything needed to play a run again: what it started from, the keys held on every step, the
+//upgrade picks in order, and world checksums to notice when playback stops matching.
+//on disk: magic, u16 version, then varints and length prefixed strings, keys run length encoded
+//as (run, mask) pairs, checksums as (frames since previous, u32) pairs, and a trailing FNV-1a
+struct Replay {
+    unsigned int seed = 0;
+    std::string patternFile;
+    uint32_t patternHash = 0;  //FNV-1a of the pattern file, 0 when there was none
+    std::string balance;       //BalanceParams::describe()
+    int checksumInterval = 60; //frames between checksums, 0 for none
+    int arenaRows = GRID_ROWS, arenaCols = GRID_COLS;
+    std::vector<KeyMask> keys; //one per step, steps that wait on an upgrade menu included
+    std::vector<unsigned char> picks;
+    std::vector<std::pair<int, uint32_t>> checksums; //(frame, world checksum)
+
+    static uint32_t HashFile(const std::string& path) {
+        MappedFile file;
+        return path.empty() || !file.open(path) ? 0 : Fnv1a(file.data(), file.size());
+    }
+
+    void save(const std::string& path) const {
+        std::vector<unsigned char> out(REPLAY_MAGIC, REPLAY_MAGIC + 4);
+        out.push_back(static_cast<unsigned char>(REPLAY_VERSION));
+        out.push_back(static_cast<unsigned char>(REPLAY_VERSION >> 8));
+        auto putString = [&](const std::string& text) {
+            PutVarint(out, text.size());
+            out.insert(out.end(), text.begin(), text.end());
+        };
+        auto putU32 = [&](uint32_t v) {
+            for (int i = 0; i < 4; ++i) out.push_back(static_cast<unsigned char>(v >> (8 * i)));
+        };
+        PutVarint(out, seed);
+        putString(patternFile);
+        putU32(patternHash);
+        putString(balance);
+        PutVarint(out, static_cast<uint64_t>(checksumInterval));
+        PutVarint(out, static_cast<uint64_t>(arenaRows));
+        PutVarint(out, static_cast<uint64_t>(arenaCols));
+
+        size_t runs = 0;
+        std::vector<unsigned char> runBytes;
+        for (size_t i = 0; i < keys.size();) {
+            size_t j = i + 1;
+            while (j < keys.size() && keys[j] == keys[i]) ++j;
+            PutVarint(runBytes, j - i);
+            runBytes.push_back(keys[i]);
+            ++runs;
+            i = j;
+        }
+        PutVarint(out, runs);
+        out.insert(out.end(), runBytes.begin(), runBytes.end());
+
+        PutVarint(out, picks.size());
+        out.insert(out.end(), picks.begin(), picks.end());
+
+        PutVarint(out, checksums.size());
+        int lastFrame = 0;
+        for (const auto& c : checksums) {
+            PutVarint(out, static_cast<uint64_t>(c.first - lastFrame));
+            putU32(c.second);
+            lastFrame = c.first;
+        }
+        putU32(Fnv1a(out.data(), out.size()));
+
+        std::ofstream file(path, std::ios::binary);
+        if (!file.write(reinterpret_cast<const char*>(out.data()), static_cast<std::streamsize>(out.size())))
+            throw std::runtime_error("Could not write replay " + path);
+    }
+
+    static Replay load(const std::string& path) {
+        MappedFile file;
+        if (!file.open(path)) throw std::runtime_error("Replay file not found");
+        const unsigned char* p = file.data();
+        const unsigned char* end = p + file.size();
+        if (file.size() < 10 || std::memcmp(p, REPLAY_MAGIC, 4) != 0) throw std::runtime_error("Not a replay file");
+        uint32_t stored = 0;
+        for (int i = 0; i < 4; ++i) stored |= static_cast<uint32_t>(end[i - 4]) << (8 * i);
+        if (Fnv1a(p, file.size() - 4) != stored) throw std::runtime_error("Replay checksum mismatch");
+        end -= 4;
+        if ((p[4] | (p[5] << 8)) != REPLAY_VERSION) throw std::runtime_error("Unsupported replay version");
+        p += 6;
+
+        auto getString = [&]() {
+            const uint64_t n = GetVarint(p, end);
+            if (n > static_cast<uint64_t>(end - p)) throw std::runtime_error("Replay truncated");
+            std::string text(reinterpret_cast<const char*>(p), static_cast<size_t>(n));
+            p += n;
+            return text;
+        };
+        auto getU32 = [&]() {
+            if (end - p < 4) throw std::runtime_error("Replay truncated");
+            uint32_t v = 0;
+            for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(*p++) << (8 * i);
+            return v;
+        };
+        Replay r;
+        r.seed = static_cast<unsigned int>(GetVarint(p, end));
+        r.patternFile = getString();
+        r.patternHash = getU32();
+        r.balance = getString();
+        r.checksumInterval = static_cast<int>(GetVarint(p, end));
+        const uint64_t rows = GetVarint(p, end), cols = GetVarint(p, end);
+        if (rows > MAX_ARENA_SIDE || cols > MAX_ARENA_SIDE || !Arena{ static_cast<int>(rows), static_cast<int>(cols) }.valid())
+            throw std::runtime_error("Replay arena size out of range");
+        r.arenaRows = static_cast<int>(rows);
+        r.arenaCols = static_cast<int>(cols);
+
+        const uint64_t runs = GetVarint(p, end);
+        for (uint64_t i = 0; i < runs; ++i) {
+            const uint64_t length = GetVarint(p, end);
+            if (p == end) throw std::runtime_error("Replay truncated");
+            if (length > (1u << 30) - r.keys.size()) throw std::runtime_error("Replay too long");
+            r.keys.insert(r.keys.end(), static_cast<size_t>(length), *p++);
+        }
+        const uint64_t pickCount = GetVarint(p, end);
+        if (pickCount > static_cast<uint64_t>(end - p)) throw std::runtime_error("Replay truncated");
+        r.picks.assign(p, p + pickCount);
+        p += pickCount;
+
+        const uint64_t checkCount = GetVarint(p, end);
+        int frame = 0;
+        for (uint64_t i = 0; i < checkCount; ++i) {
+            frame += static_cast<int>(GetVarint(p, end));
+            r.checksums.emplace_back(frame, getU32());
+        }
+        return r;
+    }
+};
+
+//feeds a recorded run back step by step, the frame argument is ignored since a step that waits on
+//an upgrade menu asks for keys without advancing the frame; quits when the recording runs out
+class ReplayInput : public InputSource {
+    std::vector<KeyMask> keys;
+    std::vector<unsigned char> picks;
+    size_t nextKey = 0;
+    size_t nextPick = 0;
+public:
+    ReplayInput(std::vector<KeyMask> keys_, std::vector<unsigned char> picks_)
+        : keys(std::move(keys_)), picks(std::move(picks_)) {}
+    KeyMask getKeys(int) override { return nextKey < keys.size() ? keys[nextKey++] : static_cast<KeyMask>(KeyQuit); }
+    int chooseUpgrade(int optionCount) override {
+        const int pick = nextPick < picks.size() ? picks[nextPick++] : 0;
+        return pick < optionCount ? pick : 0;
+    }
+};
+
+//passes another source through and writes down everything it answered
+class RecordingInput : public InputSource {
+    std::unique_ptr<InputSource> inner;
+    Replay& log;
+public:
+    RecordingInput(std::unique_ptr<InputSource> inner_, Replay& log_) : inner(std::move(inner_)), log(log_) {}
+    KeyMask getKeys(int frame) override {
+        const KeyMask keys = inner->getKeys(frame);
+        log.keys.push_back(keys);
+        return keys;
+    }
+    int chooseUpgrade(int optionCount) override {
+        const int pick = inner->chooseUpgrade(optionCount);
+        log.picks.push_back(static_cast<unsigned char>(pick));
+        return pick;
+    }
+    void restore() override { inner->restore(); }
+};
+
+//the two sides of a flat state copy: types list their fields once in a transfer(Archive&) member and
+//the writer and reader walk them the same way, each field a single memcpy
+class StateWriter {
+    unsigned char* p;
+    unsigned char* end;
+    bool overflow = false;
+public:
+    StateWriter(unsigned char* buffer, size_t capacity) : p(buffer), end(buffer + capacity) {}
+    void put(const void* src, size_t n) {
+        if (overflow || static_cast<size_t>(end - p) < n) { overflow = true; return; }
+        if (n) std::memcpy(p, src, n);
+        p += n;
+    }
+    template <typename T>
+    void pod(const T& v) {
+        static_assert(std::is_trivially_copyable<T>::value, "flat state holds trivially copyable fields only");
+        put(&v, sizeof(v));
+    }
+    template <typename T>
+    void array(const std::vector<T>& v) {
+        static_assert(std::is_trivially_copyable<T>::value, "flat state holds trivially copyable fields only");
+        const uint32_t n = static_cast<uint32_t>(v.size());
+        pod(n);
+        put(v.data(), n * sizeof(T));
+    }
+    bool overflowed() const { return overflow; }
+    unsigned char* position() const { return p; }
+};
+
+class StateReader {
+    const unsigned char* p;
+    const unsigned char* end;
+public:
+    StateReader(const unsigned char* data, size_t size) : p(data), end(data + size) {}
+    void get(void* dst, size_t n) {
+        if (static_cast<size_t>(end - p) < n) throw std::runtime_error("Truncated state");
+        if (n) std::memcpy(dst, p, n);
+        p += n;
+    }
+    template <typename T>
+    void pod(T& v) { get(&v, sizeof(v)); }
+    template <typename T>
+    void array(std::vector<T>& v) {
+        uint32_t n = 0;
+        pod(n);
+        if (n > static_cast<size_t>(end - p) / sizeof(T)) throw std::runtime_error("Truncated state");
+        v.resize(n); //keeps capacity, so a warm ring restores without allocating
+        get(v.data(), n * sizeof(T));
+    }
+};
+
+//variable sized states packed back to back in one fixed allocation, newest last; the oldest are
+//evicted as room is needed and an entry never wraps, so each one stays a single contiguous block
+class RewindRing {
+    struct Entry {
+        size_t offset, size;
+        int frame;
+    };
+    std::vector<unsigned char> arena;
+    std::vector<Entry> entries; //circular
+    size_t first = 0, count = 0;
+    size_t writePos = 0;
+    size_t reserved = 0;
+
+    Entry& at(size_t i) { return entries[(first + i) % entries.size()]; }
+    void evictOldest() {
+        first = (first + 1) % entries.size();
+        if (--count == 0) first = writePos = 0;
+    }
+public:
+    RewindRing(size_t arenaBytes, size_t maxEntries) : arena(arenaBytes), entries(std::max<size_t>(1, maxEntries)) {}
+
+    //room for one entry of at most budget bytes at the write position
+    unsigned char* reserve(size_t budget) {
+        budget = std::min(budget, arena.size());
+        if (count == entries.size()) evictOldest();
+        if (writePos + budget > arena.size()) {
+            //the tail is skipped, whatever still lives there is the oldest
+            while (count && at(0).offset >= writePos) evictOldest();
+            writePos = 0;
+        }
+        while (count && at(0).offset < writePos + budget && at(0).offset + at(0).size > writePos) evictOldest();
+        reserved = budget;
+        return arena.data() + writePos;
+    }
+    void commit(size_t size, int frame) {
+        entries[(first + count) % entries.size()] = Entry{ writePos, std::min(size, reserved), frame };
+        ++count;
+        writePos += std::min(size, reserved);
+    }
+    void clear() { first = count = writePos = 0; }
+    size_t size() const { return count; }
+    size_t capacity() const { return entries.size(); }
+    //age 0 is the newest entry
+    const unsigned char* get(size_t age, size_t& size, int& frame) {
+        const Entry& e = at(count - 1 - age);
+        size = e.size;
+        frame = e.frame;
+        return arena.data() + e.offset;
+    }
+    void dropNewest() {
+        if (!count) return;
+        --count;
+        if (!count) first = writePos = 0;
+        else writePos = at(count - 1).offset + at(count - 1).size;
+    }
+};
+
+constexpr int REWIND_SECONDS = 10;
+constexpr size_t REWIND_ARENA_BYTES = size_t(16) << 20;
+//hard cap on one frame's state, a frame over it is not captured and the history is dropped
+constexpr size_t REWIND_FRAME_BUDGET = size_t(256) << 10;
+constexpr int REWIND_FRAMES_PER_STEP = 3; //rewinds at three times play speed
+
+enum class DeathCause { None, Bullet, BossBullet, RayCore, RayCross, Count };
+
+static const char* GetDeathCauseName(DeathCause cause) {
+    switch (cause) {
+    case DeathCause::Bullet:     return "bullet";
+    case DeathCause::BossBullet: return "boss_bullet";
+    case DeathCause::RayCore:    return "ray_core";
+    case DeathCause::RayCross:   return "ray_cross";
+    default:                     return "none";
+    }
+}
+
+//how one game ended
+struct RunResult {
+    unsigned int seed = 0;
+    int frames = 0;
+    int score = 0;
+    DeathCause cause = DeathCause::None;
+};
+
+enum class InputPolicy { Idle, Random, Autopilot };
+
+struct GameConfig {
+    unsigned int seed = 0;
+    bool headless = false;
+    int maxFrames = 0;          //0 runs until death or quit
+    std::string patternFile = "pattern.txt";
+    std::string inputScript;    //empty reads the keyboard
+    bool overlay = false;       //frame time line under the arena
+    bool repeatRuns = true;     //long runs of one cell sent as REP where the terminal takes it
+    InputPolicy policy = InputPolicy::Idle; //plays when there is no script
+    BalanceParams balance;
+    std::string recordFile;     //written when the run ends, empty records nothing
+    std::shared_ptr<const Replay> replay; //plays this back instead of any other input
+    int checksumInterval = 60;  //frames between world checksums in a recording
+    bool rewind = false;        //keep REWIND_SECONDS of states for the rewind key
+    unsigned aiThreads = 1;     //threads sharing the enemy AI pass, the result is the same for any count
+    std::string broadcastName;  //shared memory ring every drawn frame is published to, empty publishes nothing
+    Arena arena;                //bigger than the classic size scrolls a GRID_ROWS x GRID_COLS view over it
+};
+
+//one generator per consumer so adding draws in one system never shifts another
+static std::mt19937 MakeRng(unsigned int seed, unsigned int stream) {
+    std::seed_seq seq{ seed, stream };
+    return std::mt19937(seq);
+}
+
+//enemies per chunk of the parallel AI pass, a wander is a few nanoseconds so chunks must be large
+//for the hand over to pay
+constexpr size_t AI_PARALLEL_GRAIN = 512;
+
 class Game {
+    friend class FrameBench;
+    friend class AllocCheck;
+    friend class ParallelAiCheck;
+    friend class SoakGame;
+    GameConfig config;
     Player player;
     BulletManager bulletManager;
-    Renderer renderer;
-    InputManager inputManager;
-    std::vector<std::unique_ptr<Bullet>> bullets;
-    std::vector<std::unique_ptr<Enemy>> enemies;
+    FrameBroadcast broadcast; //written by the renderer, so declared before it
+    std::unique_ptr<Renderer> renderer;
+    Replay recording; //filled by a RecordingInput, so declared before it
+    std::unique_ptr<InputSource> input;
+    BulletPool bullets;
+    EnemyStore enemies;
+    EnemyGrid enemyGrid;
+    //rebuilt each frame by the collision passes that use them
+    ArenaBits hostileBulletBits, playerBulletBits, rayCrossBits; //ray crosses are drawn in the classic arena only
     int frame = 0;
+    //frames played plus steps spent rewinding, never rewound itself, so --frames ends a run that rewinds
+    int playedSteps = 0;
     bool running = true;
-    std::chrono::steady_clock::time_point lastPlayerBulletTime;
-    int enemySpawnFrameCounter = 0;     // RayEnemy spawn counter (200 frames)
-    int basicSpawnFrameCounter = 0;     // Basic enemy spawn counter (166 frames)
+    int lastPlayerBulletFrame = std::numeric_limits<int>::min() / 2;
+    int lastRaySpawnFrame = 0;
+    int lastBasicSpawnFrame = 0;
+    //enemy clock, one tick per AI update; upgrade picks update the AI without advancing the frame
+    int tick = 0;
     bool upgradePending = false;
     std::vector<UpgradeType> offeredUpgrades;
     int score = 0;
+    DeathCause deathCause = DeathCause::None;
+    const uint64_t aiKey; //enemies draw from CounterRng(aiKey, serial, tick), which needs no state
+    std::mt19937 spawnRng, raySpawnRng, upgradeRng;
+    std::unique_ptr<ParallelFor> aiWorkers;
+    size_t aiGrain = AI_PARALLEL_GRAIN;
+    //derived from the deadlines in the state above and rebuilt whenever that is loaded: enemy shots
+    //and ray state changes by tick, spawns by frame
+    TimerWheel<EnemyHandle> enemyTimers{ 1024 };
+    TimerWheel<EnemyKind> spawnTimers{ 4 };
+    SpawnRamp basicRamp, rayRamp;
+    std::vector<std::pair<EnemyKind, uint32_t>> dueShots; //kind and batch index, fired in AI pass order
+    //replay checking, the first checkpoint that differs from the recording
+    size_t nextCheckpoint = 0;
+    int desyncFrame = -1;
+    std::unique_ptr<RewindRing> rewindRing;
+    size_t rewindOverflows = 0; //frames whose state was over REWIND_FRAME_BUDGET
+    //simulation thread publishes, render thread draws whichever snapshot is newest
+    TripleBuffer<WorldSnapshot> snapshots;
+    std::atomic<bool> simDone{ false };
+    std::mutex renderMutex;
+    std::condition_variable renderWake;
+#if DEFFDRED_PROFILE
+    FrameProfiler profiler;
+    LatencyHistogram renderTimes; //written by the render thread only
+#endif
 public:
-    Game() : player(GRID_COLS / 2 - 1, GRID_ROWS - 4) {}
+    explicit Game(const GameConfig& config_)
+        : config(config_), player(config_.arena.cols / 2 - 1, config_.arena.rows - 4),
+          enemyGrid(config_.arena), hostileBulletBits(config_.arena), playerBulletBits(config_.arena),
+          rayCrossBits(Arena()),
+          aiKey(CounterRng::KeyFor(config_.seed)), spawnRng(MakeRng(config_.seed, 2)),
+          raySpawnRng(MakeRng(config_.seed, 3)), upgradeRng(MakeRng(config_.seed, 4)),
+          basicRamp(config_.balance.basicSpawnInterval, config_.balance),
+          rayRamp(config_.balance.raySpawnInterval, config_.balance) {
+        if (!config.headless) renderer = std::make_unique<Renderer>(config.repeatRuns);
+        if (renderer && !config.broadcastName.empty()) {
+            if (broadcast.create(config.broadcastName, Renderer::ROWS, Renderer::COLS)) renderer->setBroadcast(&broadcast);
+            else std::cerr << "Warning: could not create broadcast " << config.broadcastName << ", playing without it.\n";
+        }
+        bulletManager.setArena(config.arena);
+        if (config.replay) input = std::make_unique<ReplayInput>(config.replay->keys, config.replay->picks);
+        else if (!config.inputScript.empty()) input = std::make_unique<ScriptedInput>(config.inputScript);
+        else if (config.policy == InputPolicy::Random) input = std::make_unique<RandomInput>(MakeRng(config.seed, 5));
+        else if (config.policy == InputPolicy::Autopilot)
+            input = std::make_unique<AutopilotInput>(AutopilotView{ player, bullets, enemies, offeredUpgrades, tick, config.arena });
+        else if (config.headless) input = std::make_unique<NullInput>();
+        else input = std::make_unique<TerminalInput>();
+        if (!config.recordFile.empty()) {
+            recording.seed = config.seed;
+            recording.patternFile = config.patternFile;
+            recording.patternHash = Replay::HashFile(config.patternFile);
+            recording.balance = config.balance.describe();
+            recording.checksumInterval = config.checksumInterval;
+            recording.arenaRows = config.arena.rows;
+            recording.arenaCols = config.arena.cols;
+            input = std::make_unique<RecordingInput>(std::move(input), recording);
+        }
+        offeredUpgrades.reserve(3);
+        dueShots.reserve(256);
+        if (config.aiThreads > 1) aiWorkers = std::make_unique<ParallelFor>(config.aiThreads);
+        if (config.rewind) rewindRing = std::make_unique<RewindRing>(REWIND_ARENA_BYTES, REWIND_SECONDS * 1000 / FRAME_MS);
+    }
+
+    //the whole simulation state as one flat block, 0 when it does not fit in capacity
+    size_t saveState(unsigned char* buffer, size_t capacity) {
+        StateWriter writer(buffer, capacity);
+        transferState(writer);
+        return writer.overflowed() ? 0 : static_cast<size_t>(writer.position() - buffer);
+    }
+    void loadState(const unsigned char* data, size_t size) {
+        StateReader reader(data, size);
+        transferState(reader);
+        rebuildEnemyGrid();
+        rebuildTimers();
+    }
+
+    void run() {
+        start();
+        play();
+        endReplay();
+        gameOver();
+    }
+
+    //fast forwards to fromFrame without pacing, then plays the rest on screen at normal speed
+    void watch(int fromFrame) {
+        start();
+        while (running && frame < fromFrame && step()) {}
+        play();
+        endReplay();
+        input->restore();
+        renderer->clearScreen();
+        printState();
+    }
+
+    //plays to the end without a terminal or frame pacing
+    RunResult simulate() {
+        start();
+        while (running && step()) {}
+        endReplay();
+        RunResult result;
+        result.seed = config.seed;
+        result.frames = frame;
+        result.score = score;
+        result.cause = deathCause;
+        return result;
+    }
+
+    //simulates and prints throughput and the final state
+    void runHeadless() {
+        auto t0 = std::chrono::steady_clock::now();
+        simulate();
+        auto t1 = std::chrono::steady_clock::now();
+        const double seconds = std::chrono::duration<double>(t1 - t0).count();
+        std::cout << "seed=" << config.seed << " frames=" << frame
+                  << " seconds=" << seconds << " fps=" << (seconds > 0 ? frame / seconds : 0.0) << "\n";
+        printState();
+#if DEFFDRED_PROFILE
+        for (int i = 0; i < static_cast<int>(Phase::Count); ++i) {
+            const LatencyHistogram& h = profiler.phases[i];
+            std::printf("%-10s p50 %8llu ns  p99 %8llu ns  max %8llu ns\n", GetPhaseName(static_cast<Phase>(i)),
+                h.percentile(0.5), h.percentile(0.99), h.max());
+        }
+#if DEFFDRED_COUNT_ALLOCS
+        char line[160];
+        profiler.allocLine(line, sizeof(line));
+        std::cout << line << "\n";
+#endif
+#endif
+    }
+
+    //after playing back a replay: whether every checksum matched, printing where it first did not
+    bool replayMatched() const {
+        const size_t expected = config.replay ? config.replay->checksums.size() : 0;
+        if (desyncFrame >= 0) {
+            std::cout << "replay desync at frame " << desyncFrame << " (checkpoint " << nextCheckpoint << " of "
+                      << expected << ")\n";
+            return false;
+        }
+        std::cout << "replay ok, " << expected << " checksums matched\n";
+        return true;
+    }
+
+private:
+    void printState() const {
+        const size_t alive = enemies.alive();
+        std::cout << "score=" << score << " hp=" << player.hp << "/" << player.maxHp
+                  << " money=" << player.money << " player=" << player.x << "," << player.y
+                  << " enemies=" << alive << "/" << enemies.spawnedCount() << " bullets=" << bullets.size()
+                  << " dead=" << (player.hp <= 0 ? 1 : 0) << " cause=" << GetDeathCauseName(deathCause) << "\n";
+        if (!bulletManager.lastError().empty()) std::cout << "pattern error: " << bulletManager.lastError() << "\n";
+    }
+
+    //simulates at a fixed FRAME_MS step on this thread while a render thread draws the newest snapshot,
+    //so a slow terminal costs rendered frames but never simulation steps
+    void play() {
+        std::thread renderThread(&Game::renderLoop, this);
+        const std::chrono::milliseconds stepTime(FRAME_MS);
+        auto next = std::chrono::steady_clock::now();
+        while (running && step()) {
+            next += stepTime;
+            const auto now = std::chrono::steady_clock::now();
+            if (now - next > stepTime * 5) next = now; //stalled (e.g. suspended), resume instead of catching up
+            std::this_thread::sleep_until(next);
+        }
+        simDone = true;
+        wakeRenderer();
+        renderThread.join();
+    }
+
+    //every field a frame depends on; the enemy grid is derived and rebuilt, the loaded pattern is not
+    //state, only how far through it spawning has got
+    template <typename Archive>
+    void transferState(Archive& a) {
+        a.pod(frame); a.pod(score); a.pod(deathCause); a.pod(lastPlayerBulletFrame);
+        a.pod(lastRaySpawnFrame); a.pod(lastBasicSpawnFrame); a.pod(tick); a.pod(upgradePending);
+        a.array(offeredUpgrades); a.pod(player);
+        a.pod(spawnRng); a.pod(raySpawnRng); a.pod(upgradeRng);
+        bullets.transfer(a);
+        enemies.transfer(a);
+        bulletManager.transferCursor(a);
+    }
+
+    void rebuildEnemyGrid() {
+        enemyGrid.clear();
+        for (const EnemyBatch* batch : std::initializer_list<const EnemyBatch*>{ &enemies.basics, &enemies.rays, &enemies.bosses }) {
+            const ShapeMask& mask = GetEnemyHitMask(batch->kind);
+            for (size_t i = 0; i < batch->size(); ++i) enemyGrid.insert(static_cast<int>(batch->slot[i]), batch->x[i], batch->y[i], mask);
+        }
+    }
+
+    //the timers due after the current tick and frame, from the deadlines each enemy and spawner keeps
+    void rebuildTimers() {
+        enemyTimers.reset(tick);
+        for (const EnemyBatch* batch : { &enemies.basics, &enemies.bosses })
+            for (size_t i = 0; i < batch->size(); ++i) enemyTimers.schedule(batch->fireTick[i], enemies.handle(batch->slot[i]));
+        const RayBatch& rays = enemies.rays;
+        for (size_t i = 0; i < rays.size(); ++i) enemyTimers.schedule(rays.stateEndTick[i], enemies.handle(rays.slot[i]));
+
+        spawnTimers.reset(frame);
+        scheduleSpawn(EnemyKind::Basic, basicRamp.nextAfter(lastBasicSpawnFrame));
+        scheduleSpawn(EnemyKind::Ray, rayRamp.nextAfter(lastRaySpawnFrame));
+        scheduleSpawn(EnemyKind::Boss, nextBossFrame(frame));
+    }
+    void scheduleSpawn(EnemyKind kind, int at) {
+        if (at < std::numeric_limits<int>::max()) spawnTimers.schedule(at, kind);
+    }
+    //by default frame 2250 and every 500 frames after
+    int nextBossFrame(int after) const {
+        const BalanceParams& balance = config.balance;
+        if (balance.bossEveryFrames <= 0) return std::numeric_limits<int>::max();
+        if (after < balance.bossFirstFrame) return balance.bossFirstFrame;
+        const int64_t next = balance.bossFirstFrame
+            + (static_cast<int64_t>(after - balance.bossFirstFrame) / balance.bossEveryFrames + 1) * balance.bossEveryFrames;
+        return static_cast<int>(std::min<int64_t>(next, std::numeric_limits<int>::max()));
+    }
+
+    void captureRewind() {
+        if (!rewindRing) return;
+        const size_t size = saveState(rewindRing->reserve(REWIND_FRAME_BUDGET), REWIND_FRAME_BUDGET);
+        if (size) {
+            rewindRing->commit(size, frame);
+        } else {
+            //a gap would rewind across frames that were never captured
+            rewindRing->clear();
+            ++rewindOverflows;
+        }
+    }
+
+    //steps back through the history, the oldest capture stays so play resumes from it
+    void rewind(int frames) {
+        for (int i = 0; i < frames && rewindRing->size() > 1; ++i) rewindRing->dropNewest();
+        if (!rewindRing->size()) return;
+        size_t size = 0;
+        int at = 0;
+        const unsigned char* data = rewindRing->get(0, size, at);
+        loadState(data, size);
+    }
+
+    //everything the simulation carries from frame to frame apart from generator states, which show
+    //up in positions within a few frames anyway; deadlines are hashed as the countdowns they replaced
+    //so recordings from before the timer wheel still check
+    uint32_t worldChecksum() const {
+        uint32_t hash = 2166136261u;
+        auto mix = [&](const auto& values) {
+            if (!values.empty())
+                hash = Fnv1a(reinterpret_cast<const unsigned char*>(values.data()), values.size() * sizeof(values[0]), hash);
+        };
+        auto mixRemaining = [&](const std::vector<int>& deadlines) {
+            for (int deadline : deadlines) {
+                const int remaining = std::max(0, deadline - tick);
+                hash = Fnv1a(reinterpret_cast<const unsigned char*>(&remaining), sizeof(remaining), hash);
+            }
+        };
+        const int scalars[] = { frame, score, frame - lastRaySpawnFrame, frame - lastBasicSpawnFrame,
+            lastPlayerBulletFrame, upgradePending ? 1 : 0, player.x, player.y, player.hp, player.maxHp, player.money,
+            player.fireCooldownMs, player.bulletSpeed, player.damage, player.moveSpeed, player.bulletStreams,
+            player.lifeStealPercent };
+        hash = Fnv1a(reinterpret_cast<const unsigned char*>(scalars), sizeof(scalars), hash);
+        mix(bullets.x); mix(bullets.y); mix(bullets.dx); mix(bullets.dy); mix(bullets.symbol); mix(bullets.owner);
+        for (const EnemyBatch* batch : { &enemies.basics, static_cast<const EnemyBatch*>(&enemies.rays), &enemies.bosses }) {
+            mix(batch->x); mix(batch->y); mix(batch->hp); mixRemaining(batch->fireTick); mix(batch->dx); mix(batch->dy);
+            mix(batch->moveFrameCounter); mix(batch->burstSteps);
+            if (batch != &enemies.rays) {
+                mixRemaining(batch->pauseEndTick);
+                continue;
+            }
+            //a ray's pause stands still while it flashes and fires
+            for (size_t i = 0; i < enemies.rays.size(); ++i) {
+                const int remaining = std::max(0, enemies.rays.pauseEndTick[i] - enemies.rays.wanderResumeTick(i, tick));
+                hash = Fnv1a(reinterpret_cast<const unsigned char*>(&remaining), sizeof(remaining), hash);
+            }
+        }
+        mix(enemies.rays.state); mixRemaining(enemies.rays.stateEndTick); mix(enemies.rays.playerDamagedThisFire);
+        return hash;
+    }
+
+    //records or checks the world checksum, only while recording or playing back
+    void checkpoint() {
+        if (config.recordFile.empty() && !config.replay) return;
+        const uint32_t sum = worldChecksum();
+        if (!config.recordFile.empty()) recording.checksums.emplace_back(frame, sum);
+        if (config.replay && desyncFrame < 0) {
+            const auto& expected = config.replay->checksums;
+            if (nextCheckpoint >= expected.size() || expected[nextCheckpoint] != std::make_pair(frame, sum)) desyncFrame = frame;
+            else ++nextCheckpoint;
+        }
+    }
+
+    //final checkpoint, the recording is saved here
+    void endReplay() {
+        checkpoint();
+        if (config.replay && desyncFrame < 0 && nextCheckpoint != config.replay->checksums.size()) desyncFrame = frame;
+        if (config.recordFile.empty()) return;
+        try {
+            recording.save(config.recordFile);
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Warning: " << e.what() << "\n";
+        }
+    }
+
+    void wakeRenderer() {
+        { std::lock_guard<std::mutex> lock(renderMutex); }
+        renderWake.notify_one();
+    }
+
+    void renderLoop() {
+        bool menuShown = false;
+        for (;;) {
+            const bool done = simDone;
+            if (snapshots.fetch()) {
+                const WorldSnapshot& world = snapshots.readBuffer();
+                if (world.upgradePending) {
+                    if (!menuShown) renderer->drawUpgradeMenu(world);
+                    menuShown = true;
+                    continue;
+                }
+                menuShown = false;
+#if DEFFDRED_PROFILE
+                const auto t0 = std::chrono::steady_clock::now();
+#endif
+                renderer->draw(world);
+#if DEFFDRED_PROFILE
+                renderTimes.record(static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - t0).count()));
+#endif
+            } else if (done) {
+                break;
+            } else {
+                std::unique_lock<std::mutex> lock(renderMutex);
+                renderWake.wait_for(lock, std::chrono::milliseconds(FRAME_MS), [&] { return snapshots.hasFresh() || simDone; });
+            }
+        }
+    }
+
+    //top left arena cell of the view, which keeps the player centred until it meets an edge
+    int viewX() const { return std::max(0, std::min(config.arena.cols - GRID_COLS, player.x + 1 - GRID_COLS / 2)); }
+    int viewY() const { return std::max(0, std::min(config.arena.rows - GRID_ROWS, player.y + 1 - GRID_ROWS / 2)); }
+
+    //the snapshot is in view coordinates and holds only what can show in the view, so drawing costs
+    //the same however big the arena is
+    void capture(WorldSnapshot& world) const {
+        const int vx = viewX(), vy = viewY();
+        //widest enemy shape, so one partly in view is kept
+        const int margin = 4;
+        auto near = [&](int x, int y) {
+            return x >= vx - margin && x < vx + GRID_COLS + margin && y >= vy - margin && y < vy + GRID_ROWS + margin;
+        };
+        world.frame = frame;
+        world.score = score;
+        world.player = player;
+        world.player.x -= vx;
+        world.player.y -= vy;
+        world.enemies.clear();
+        for (const EnemyBatch* batch : { &enemies.basics, &enemies.bosses }) {
+            for (size_t i = 0; i < batch->size(); ++i) {
+                if (near(batch->x[i], batch->y[i])) world.enemies.push_back(EnemyView{ batch->x[i] - vx, batch->y[i] - vy, batch->kind });
+            }
+        }
+        world.rays.clear();
+        const RayBatch& rays = enemies.rays;
+        for (size_t i = 0; i < rays.size(); ++i) {
+            //a cross runs the whole arena, so a ray shows when its columns or rows pass through the view
+            const bool crossing = (rays.x[i] + 1 >= vx && rays.x[i] - 1 < vx + GRID_COLS)
+                || (rays.y[i] + 1 >= vy && rays.y[i] - 1 < vy + GRID_ROWS);
+            if (crossing) world.rays.push_back(RayView{ rays.x[i] - vx, rays.y[i] - vy, rays.state[i] });
+        }
+        if (config.arena.classic()) {
+            world.bulletX.assign(bullets.x.begin(), bullets.x.end());
+            world.bulletY.assign(bullets.y.begin(), bullets.y.end());
+            world.bulletSymbol.assign(bullets.symbol.begin(), bullets.symbol.end());
+        } else {
+            world.bulletX.clear();
+            world.bulletY.clear();
+            world.bulletSymbol.clear();
+            for (size_t i = 0; i < bullets.size(); ++i) {
+                const int bx = bullets.x[i] - vx, by = bullets.y[i] - vy;
+                if (bx < 0 || bx >= GRID_COLS || by < 0 || by >= GRID_ROWS) continue;
+                world.bulletX.push_back(bx);
+                world.bulletY.push_back(by);
+                world.bulletSymbol.push_back(bullets.symbol[i]);
+            }
+        }
+        world.upgradePending = upgradePending;
+        for (int i = 0; i < 3 && i < static_cast<int>(offeredUpgrades.size()); ++i) world.offered[i] = offeredUpgrades[i];
+        world.overlay[0] = '\0';
+#if DEFFDRED_PROFILE
+        if (config.overlay) profiler.overlayLine(world.overlay, sizeof(world.overlay));
+#endif
+    }
+
+    void publishSnapshot() {
+        capture(snapshots.writeBuffer());
+        snapshots.publish();
+        wakeRenderer();
+    }
 
-    void run(const std::string& patternFile) {
+    void start() {
         try {
-            bulletManager.loadPattern(patternFile);
+            if (!config.patternFile.empty()) bulletManager.loadPattern(config.patternFile);
         }
         catch (const std::exception& e) {
             std::cerr << "Error loading pattern: " << e.what() << "\nStarting empty level.\n";
         }
-        enemies.push_back(std::make_unique<Enemy>(GRID_COLS / 2 - 1, 2));
-        enemies.push_back(std::make_unique<RayEnemy>(GRID_COLS / 2 - 1, GRID_ROWS / 2));
-
-        lastPlayerBulletTime = std::chrono::steady_clock::now() - std::chrono::milliseconds(500);
-
-        while (running) {
-            auto start = std::chrono::steady_clock::now();
-            std::set<char> inputs = inputManager.getInputs();
-            if (inputs.count('q')) break;
-            player.move(inputs);
-            bulletManager.spawnBullets(frame, bullets);
-            for (auto& b : bullets) b->update();
-            bullets.erase(std::remove_if(bullets.begin(), bullets.end(),
-                [](const std::unique_ptr<Bullet>& b) { return b->isOutOfBounds(); }), bullets.end());
-            for (const auto& b : bullets) {
-                if ((b->symbol == '*' || b->symbol == 'O') && player.collides(*b)) {
-                    int dmg = (b->symbol == 'O') ? 3 : 1;
-                    int newHp = player.hp - dmg;
-                    if (newHp < 0) newHp = 0;
-                    player.hp = newHp;
-                    if (player.hp <= 0) {
-                        running = false;
-                        break;
-                    }
+        spawnEnemy(EnemyKind::Basic, config.arena.cols / 2 - 1, 2);
+        spawnEnemy(EnemyKind::Ray, config.arena.cols / 2 - 1, config.arena.rows / 2);
+        rebuildTimers();
+        captureRewind();
+#if DEFFDRED_PROFILE
+        profiler.startFrames();
+#endif
+    }
+
+    //one frame of the game, false once the player quits or the frame limit is reached
+    bool step() {
+        if (config.maxFrames > 0 && playedSteps >= config.maxFrames) return false;
+#if DEFFDRED_PROFILE
+        const auto frameStart = std::chrono::steady_clock::now();
+#endif
+        KeyMask keys;
+        {
+            PROFILE_PHASE(Phase::Input);
+            keys = input->getKeys(frame);
+        }
+        if (keys & KeyQuit) return false;
+        if ((keys & KeyRewind) && rewindRing) {
+            ++playedSteps;
+            rewind(REWIND_FRAMES_PER_STEP);
+            if (renderer) publishSnapshot();
+            return true;
+        }
+        {
+            PROFILE_PHASE(Phase::Movement);
+            withArena([&](const auto& arena) { player.move(keys, arena); });
+        }
+        {
+            PROFILE_PHASE(Phase::Spawning);
+            bulletManager.spawnBullets(frame, bullets, player.x + 1, player.y + 1);
+        }
+        {
+            PROFILE_PHASE(Phase::Movement);
+            updateBullets();
+        }
+        {
+            PROFILE_PHASE(Phase::Collision);
+            withArena([&](const auto& arena) { hitPlayerWithBullets(arena); });
+        }
+        {
+            PROFILE_PHASE(Phase::Movement);
+            updateEnemies();
+        }
+        {
+            PROFILE_PHASE(Phase::Collision);
+            withArena([&](const auto& arena) { hitEnemiesWithPlayerBullets(arena); });
+        }
+        {
+            PROFILE_PHASE(Phase::Rays);
+            withArena([&](const auto& arena) { checkRays(arena); });
+        }
+        const bool waitedOnPlayer = upgradePending || player.money >= player.maxMoney;
+        if (waitedOnPlayer) {
+            PROFILE_PHASE(Phase::Upgrades);
+            if (!upgradePending) offerUpgrades();
+            if (renderer) publishSnapshot(); //puts the menu up
+            chooseUpgrade();
+        } else {
+            if (renderer) {
+                PROFILE_PHASE(Phase::Snapshot);
+                publishSnapshot();
+            }
+            PROFILE_PHASE(Phase::Spawning);
+            if (keys & KeyFire) firePlayerBullets();
+            advanceFrame();
+            ++playedSteps;
+            if (config.checksumInterval > 0 && frame % config.checksumInterval == 0) checkpoint();
+            captureRewind();
+        }
+#if DEFFDRED_PROFILE
+        profiler.endFrame(static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - frameStart).count()), waitedOnPlayer);
+#endif
+        return true;
+    }
+
+    //runs fn with ClassicArena when the arena is the classic size, so the bounds in it are constants
+    template <typename Fn>
+    void withArena(Fn fn) {
+        if (config.arena.classic()) fn(ClassicArena());
+        else fn(config.arena);
+    }
+
+    void updateBullets() {
+        bullets.step(BestBulletStep(), config.arena);
+    }
+
+    //fast bullets are swept through every cell of their step, the rest tested where they landed
+    template <typename A>
+    void hitPlayerWithBullets(const A& arena) {
+        hostileBulletBits.clear();
+        bool anyFast = false;
+        for (size_t i = 0; i < bullets.size(); ++i) {
+            if (bullets.owner[i] != BulletOwner::Enemy) continue;
+            if (bullets.isFast(i)) anyFast = true;
+            else hostileBulletBits.set(arena, bullets.x[i], bullets.y[i]);
+        }
+        //stacked bullets each deal damage, so only a confirmed overlap walks the list
+        const bool slowOverlap = hostileBulletBits.overlaps(Player::mask, player.x, player.y);
+        if (!slowOverlap && !anyFast) return;
+        auto hitsPlayer = [&](int cx, int cy) { return player.collides(cx, cy); };
+        for (size_t i = 0; i < bullets.size(); ++i) {
+            if (bullets.owner[i] != BulletOwner::Enemy) continue;
+            const bool hit = bullets.isFast(i) ? bullets.sweep(i, hitsPlayer)
+                : slowOverlap && player.collides(bullets.x[i], bullets.y[i]);
+            if (hit) {
+                int dmg = (bullets.symbol[i] == 'O') ? 3 : 1;
+                int newHp = player.hp - dmg;
+                if (newHp < 0) newHp = 0;
+                player.hp = newHp;
+                if (player.hp <= 0) {
+                    deathCause = bullets.symbol[i] == 'O' ? DeathCause::BossBullet : DeathCause::Bullet;
+                    running = false;
+                    break;
                 }
             }
-            for (auto& enemyPtr : enemies) {
-                if (!enemyPtr->isAlive()) continue;
-                enemyPtr->update();
-
-                if (enemyPtr->canFire()) {
-                    if (Boss* boss = dynamic_cast<Boss*>(enemyPtr.get())) {
-                        const int cx = boss->x + 1;
-                        const int cy = boss->y + 0; // centre row and column
-
-                        const int dirs[16][2] = {
-                            {  0, -2 }, {  2,  0 }, {  0,  2 }, { -2,  0 },
-                            {  2, -2 }, {  2,  2 }, { -2,  2 }, { -2, -2 },
-                            {  2, -1 }, {  1, -2 }, {  2,  1 }, {  1,  2 },
-                            { -2,  1 }, { -1,  2 }, { -2, -1 }, { -1, -2 }
-                        };
-
-                        for (int i = 0; i < 16; ++i) {
-                            int dx = dirs[i][0];
-                            int dy = dirs[i][1];
-                            if (cx >= 0 && cx < GRID_COLS && cy >= 0 && cy < GRID_ROWS) {
-                                bullets.push_back(std::make_unique<Bullet>(cx, cy, dx, dy, 'O'));
-                            }
-                        }
-                        enemyPtr->resetFire();
-                        continue;
-                    }
+        }
+    }
+
+    //16 'O's in every compass and half compass direction at two cells a frame
+    static const Emitter& bossRing() {
+        static const Emitter ring = [] {
+            Emitter e;
+            e.count = 16;
+            e.angleStep = 22.5f;
+            e.speed = 2;
+            e.symbol = 'O';
+            return e;
+        }();
+        return ring;
+    }
+
+    //every enemy wanders on its own draws, which lets the pass run in parallel with the same result as
+    //run serially; then grid moves, and the timer wheel fires the shots and ray state changes due this
+    //tick, basics before bosses in batch order as the passes used to fire them
+    void updateEnemies() {
+        ++tick;
+        const int px = player.x + 1, py = player.y + 1;
+        EnemyBatch& basics = enemies.basics;
+        RayBatch& rays = enemies.rays;
+        EnemyBatch& bosses = enemies.bosses;
+
+        //only cooling down rays move, flashing and firing ones hold their cross still
+        const size_t basicEnd = basics.size(), rayEnd = basicEnd + rays.size(), total = rayEnd + bosses.size();
+        withArena([&](const auto& arena) {
+            const auto wanderRange = [&](size_t begin, size_t end) {
+                for (size_t k = begin; k < end; ++k) {
+                    EnemyBatch& batch = k < basicEnd ? basics : k < rayEnd ? static_cast<EnemyBatch&>(rays) : bosses;
+                    const size_t i = k < basicEnd ? k : k < rayEnd ? k - basicEnd : k - rayEnd;
+                    if (&batch == &rays && rays.state[i] != RayState::Cooldown) continue;
+                    CounterRng rng(aiKey, enemies.slots[batch.slot[i]].serial, static_cast<uint32_t>(tick));
+                    batch.wander(i, tick, rng, arena);
+                }
+            };
+            if (aiWorkers) aiWorkers->run(total, aiGrain, wanderRange);
+            else wanderRange(0, total);
+        });
+
+        for (const EnemyBatch* batch : std::initializer_list<const EnemyBatch*>{ &basics, &rays, &bosses }) {
+            const ShapeMask& mask = GetEnemyHitMask(batch->kind);
+            for (size_t i = 0; i < batch->size(); ++i) enemyGrid.sync(batch->slot[i], batch->x[i], batch->y[i], mask);
+        }
+
+        //timers of enemies that died since they were set no longer resolve and are dropped
+        dueShots.clear();
+        enemyTimers.advance(tick, [&](EnemyHandle handle) {
+            if (!enemies.valid(handle)) return;
+            const EnemyStore::Slot& slot = enemies.slots[handle.slot];
+            if (slot.kind == EnemyKind::Ray) enemyTimers.schedule(rays.advanceState(slot.index, tick), handle);
+            else dueShots.emplace_back(slot.kind, slot.index);
+        });
+        std::sort(dueShots.begin(), dueShots.end(), [](const std::pair<EnemyKind, uint32_t>& a, const std::pair<EnemyKind, uint32_t>& b) {
+            const bool aBoss = a.first == EnemyKind::Boss, bBoss = b.first == EnemyKind::Boss;
+            return aBoss != bBoss ? bBoss : a.second < b.second;
+        });
+
+        const int basicCooldown = GetEnemyStats(EnemyKind::Basic).fireCooldown;
+        const int bossCooldown = GetEnemyStats(EnemyKind::Boss).fireCooldown;
+        for (const auto& shot : dueShots) {
+            const size_t i = shot.second;
+            if (shot.first == EnemyKind::Boss) {
+                //ring from the centre column of the top row
+                BulletManager::fire(bossRing(), bosses.x[i] + 1, bosses.y[i], 0, px, py, bullets, config.arena);
+                bosses.fireTick[i] = tick + bossCooldown;
+                enemyTimers.schedule(bosses.fireTick[i], enemies.handle(bosses.slot[i]));
+                continue;
+            }
+
+            //aim a single * at the player
+            const int ex = basics.x[i] + 1, ey = basics.y[i] + 1;
+            int dx = px - ex;
+            int dy = py - ey;
+            if (dx < 0) dx = -1;
+            else if (dx > 0) dx = 1;
+            else dx = 0;
+            if (dy < 0) dy = -1;
+            else if (dy > 0) dy = 1;
+            else dy = 0;
+            if (py > ey) dy = 1;
+            bullets.spawn(basics.x[i], basics.y[i] + 1, dx, dy, '*', BulletOwner::Enemy);
+            basics.fireTick[i] = tick + basicCooldown;
+            enemyTimers.schedule(basics.fireTick[i], enemies.handle(basics.slot[i]));
+        }
+    }
+
+    //player bullets damage enemies (with life steal and single death reward)
+    //a fast bullet hits in the first occupied cell along its step
+    template <typename A>
+    void hitEnemiesWithPlayerBullets(const A& arena) {
+        playerBulletBits.clear();
+        bool anyFast = false;
+        for (size_t i = 0; i < bullets.size(); ++i) {
+            if (bullets.owner[i] != BulletOwner::Player) continue;
+            if (bullets.isFast(i)) anyFast = true;
+            else playerBulletBits.set(arena, bullets.x[i], bullets.y[i]);
+        }
+        if (!anyFast && !playerBulletBits.intersects(enemyGrid.occupied())) return;
+
+        const ArenaBits& occupied = enemyGrid.occupied();
+        bool killed = false;
+        size_t bi = 0;
+        while (bi < bullets.size()) {
+            if (bullets.owner[bi] != BulletOwner::Player) { ++bi; continue; }
+            int hx = bullets.x[bi], hy = bullets.y[bi];
+            const bool reached = bullets.isFast(bi)
+                ? bullets.sweep(bi, [&](int cx, int cy) { hx = cx; hy = cy; return occupied.test(arena, cx, cy); })
+                : occupied.test(arena, hx, hy);
+            if (!reached) { ++bi; continue; }
 
-                    //default enemy fire aiming a single * at the player
-                    int px = player.x + 1, py = player.y + 1;
-                    int ex = enemyPtr->x + 1, ey = enemyPtr->y + 1;
-                    int dx = px - ex;
-                    int dy = py - ey;
-                    if (dx < 0) dx = -1;
-                    else if (dx > 0) dx = 1;
-                    else dx = 0;
-                    if (dy < 0) dy = -1;
-                    else if (dy > 0) dy = 1;
-                    else dy = 0;
-                    if (py > ey) dy = 1;
-                    bullets.push_back(std::make_unique<Bullet>(enemyPtr->x, enemyPtr->y + 1, dx, dy, '*'));
-                    enemyPtr->resetFire();
-                }
+            //bucket holds every live enemy whose cells or adjacent spots cover the bullet,
+            //the earliest spawned one takes the hit
+            int target = -1;
+            for (int slot : enemyGrid.at(hx, hy)) {
+                if (target < 0 || enemies.slots[slot].serial < enemies.slots[target].serial) target = slot;
             }
-            //player bullets damage enemies (with life steal and single death reward)
-            for (auto& enemyPtr : enemies) {
-                if (!enemyPtr->isAlive()) continue;
-
-                bool enemyDied = false;
-                for (auto& b : bullets) {
-                    if (enemyDied) break;
-                    if (b->symbol != 'o') continue;
-
-                    bool damaged = false;
-                    for (int sy = 0; sy < static_cast<int>(enemyPtr->shape.size()) && !damaged; ++sy) {
-                        for (int sx = 0; sx < static_cast<int>(enemyPtr->shape[sy].size()) && !damaged; ++sx) {
-                            if (enemyPtr->shape[sy][sx] == ' ') continue;
-
-                            const int ex = enemyPtr->x + sx;
-                            const int ey = enemyPtr->y + sy;
-
-							//hit if bullet is on the enemy cell or in any adjacent spot
-                            if ((b->x > ex ? b->x - ex : ex - b->x) + (b->y > ey ? b->y - ey : ey - b->y) <= 1) {
-                                const int beforeHp = enemyPtr->hp;
-
-                                int dmg = player.damage;
-                                if (dmg < 0) dmg = 0;
-                                int dealt = beforeHp < dmg ? beforeHp : dmg;
-                                if (dealt < 0) dealt = 0;
-
-                                enemyPtr->hp = enemyPtr->hp - dmg;
-                                b->x = -100; //mark bullet for removal
-                                damaged = true;
-
-                                if (dealt > 0 && player.lifeStealPercent > 0) {
-                                    int heal = (dealt * player.lifeStealPercent) / 100;
-                                    if (heal > 0) {
-                                        int newHp = player.hp + heal;
-                                        player.hp = newHp > player.maxHp ? player.maxHp : newHp;
-                                    }
-                                }
-
-                                //award money and score if alive
-                                if (beforeHp > 0 && enemyPtr->hp <= 0) {
-                                    player.money += 10;
-                                    score += 50;
-                                    enemyDied = true;
-                                }
-                            }
-                        }
-                    }
+            if (target < 0) { ++bi; continue; }
+
+            const EnemyStore::Slot& ref = enemies.slots[target];
+            int& enemyHp = enemies.batch(ref.kind).hp[ref.index];
+            const int beforeHp = enemyHp;
+
+            int dmg = player.damage;
+            if (dmg < 0) dmg = 0;
+            int dealt = beforeHp < dmg ? beforeHp : dmg;
+            if (dealt < 0) dealt = 0;
+
+            enemyHp = enemyHp - dmg;
+            bullets.remove(bi); //swapped-in bullet is checked next
+
+            if (dealt > 0 && player.lifeStealPercent > 0) {
+                int heal = (dealt * player.lifeStealPercent) / 100;
+                if (heal > 0) {
+                    int newHp = player.hp + heal;
+                    player.hp = newHp > player.maxHp ? player.maxHp : newHp;
                 }
             }
-            for (auto& enemyPtr : enemies) {
-                RayEnemy* ray = dynamic_cast<RayEnemy*>(enemyPtr.get());
-                if (ray && ray->isFiring() && enemyPtr->isAlive()) {
-                    int ex = ray->x, ey = ray->y;
-                    // Vertical ray
-                    if (player.x + 1 == ex + 1 && std::abs(player.y + 1 - (ey + 1)) <= 3) {
-                        player.hp = 0;
-                        running = false;
-                    }
-                    // Horizontal ray
-                    if (player.y + 1 == ey + 1 && std::abs(player.x + 1 - (ex + 1)) <= 8) {
-                        player.hp = 0;
-                        running = false;
-                    }
-                }
+
+            //award money and score if alive
+            if (beforeHp > 0 && enemyHp <= 0) {
+                player.money += 10;
+                score += 50;
+                enemyGrid.remove(target);
+                killed = true;
             }
-            // RayEnemy collision: during firing, player touching the 3-wide cross is hit once per firing cycle
-            for (auto& enemyPtr : enemies) {
-                RayEnemy* ray = dynamic_cast<RayEnemy*>(enemyPtr.get());
-                if (!ray || !enemyPtr->isAlive() || !ray->isFiring()) continue;
-                if (ray->playerDamagedThisFire) continue; // already applied this cycle
-
-                int ex = ray->x;
-                int ey = ray->y;
-
-                bool hit = false;
-                for (int pdy = 0; pdy < static_cast<int>(player.shape.size()) && !hit; ++pdy) {
-                    for (int pdx = 0; pdx < static_cast<int>(player.shape[pdy].size()) && !hit; ++pdx) {
-                        if (player.shape[pdy][pdx] == ' ') continue;
-                        int px = player.x + pdx;
-                        int py = player.y + pdy;
-                        if ((px >= ex - 1 && px <= ex + 1) || (py >= ey - 1 && py <= ey + 1)) {
-                            hit = true;
-                        }
-                    }
-                }
-                if (hit) {
-                    int newHp = player.hp - RayEnemy::DAMAGE;
-                    if (newHp < 0) newHp = 0;
-                    player.hp = newHp;
-                    ray->playerDamagedThisFire = true;
-                    if (player.hp <= 0) {
-                        running = false;
-                        break;
-                    }
-                }
+        }
+        if (killed) enemies.reclaim();
+    }
+
+    template <typename A>
+    void checkRays(const A& arena) {
+        RayBatch& rays = enemies.rays;
+        for (size_t i = 0; i < rays.size(); ++i) {
+            if (rays.state[i] != RayState::Firing) continue;
+            int ex = rays.x[i], ey = rays.y[i];
+            // Vertical ray
+            if (player.x + 1 == ex + 1 && std::abs(player.y + 1 - (ey + 1)) <= 3) {
+                player.hp = 0;
+                deathCause = DeathCause::RayCore;
+                running = false;
             }
-            if (!upgradePending && player.money >= player.maxMoney) {
-                offerUpgrades();
+            // Horizontal ray
+            if (player.y + 1 == ey + 1 && std::abs(player.x + 1 - (ex + 1)) <= 8) {
+                player.hp = 0;
+                deathCause = DeathCause::RayCore;
+                running = false;
             }
-            if (upgradePending) {
-                renderer.clearScreen();
-                std::cout << "Choose an upgrade:\n";
-                for (int i = 0; i < 3; ++i) {
-                    std::cout << (i + 1) << ". " << GetUpgradeName(offeredUpgrades[i]) << "\n";
-                }
-                std::cout << "Press 1, 2, or 3 to select.\n";
-                int choice = 0;
-                while (choice < 1 || choice > 3) {
-                    char ch;
-#ifdef _WIN32
-                    ch = _getch();
-#else
-                    std::cin >> ch;
-#endif
-                    choice = ch - '0';
-                }
-                applyUpgrade(offeredUpgrades[choice - 1]);
-                player.money = 0;
-                upgradePending = false;
-                continue;
+        }
+        // RayEnemy collision: during firing, player touching the 3-wide cross is hit once per firing cycle.
+        //in the classic arena one bitset test rules most frames out; a bigger one would pay for drawing
+        //every cross across it, so there each firing ray is tested on its own below
+        if (std::is_same<A, ClassicArena>::value) {
+            rayCrossBits.clear();
+            for (size_t i = 0; i < rays.size(); ++i) {
+                if (rays.state[i] != RayState::Firing || rays.playerDamagedThisFire[i]) continue;
+                for (int y = 0; y < arena.rows; ++y) rayCrossBits.setSpan(arena, y, rays.x[i] - 1, rays.x[i] + 1);
+                for (int y = rays.y[i] - 1; y <= rays.y[i] + 1; ++y) rayCrossBits.setSpan(arena, y, 0, arena.cols - 1);
             }
-            renderer.draw(player, enemies, bullets, frame);
-            std::cout << "Frame: " << frame << " | Use WASD to move, Q to quit\n";
-            if (inputs.count(' ')) {
-                auto now = std::chrono::steady_clock::now();
-                if (std::chrono::duration_cast<std::chrono::milliseconds>(now - lastPlayerBulletTime).count() >= player.fireCooldownMs) {
-                    int bulletX = player.x + 1;
-                    int bulletY = player.y;
-                    int spd = (player.bulletSpeed < 0) ? -player.bulletSpeed : player.bulletSpeed;
-
-                    std::vector<std::pair<int,int>> dirs;
-                    dirs.push_back({ 0, player.bulletSpeed });
-
-                    if (player.bulletStreams >= 2) dirs.push_back({ -1, player.bulletSpeed }); //up left
-                    if (player.bulletStreams >= 3) dirs.push_back({ +1, player.bulletSpeed }); //up right
-                    if (player.bulletStreams >= 4) dirs.push_back({ -spd, 0 });                //left
-                    if (player.bulletStreams >= 5) dirs.push_back({ +spd, 0 });                //right
-                    if (player.bulletStreams >= 6) dirs.push_back({ -1, +spd });               //down left
-                    if (player.bulletStreams >= 7) dirs.push_back({ +1, +spd });               //down right
-                    if (player.bulletStreams >= 8) dirs.push_back({ 0, +spd });                //down
-
-                    for (const auto& d : dirs) {
-                        if (bulletX >= 0 && bulletX < GRID_COLS && bulletY >= 0 && bulletY < GRID_ROWS) {
-                            bullets.push_back(std::make_unique<Bullet>(bulletX, bulletY, d.first, d.second, 'o'));
-                        }
-                    }
+            if (!rayCrossBits.overlaps(Player::mask, player.x, player.y)) return;
+        }
+
+        const ShapeMask& shipMask = Player::mask;
+        for (size_t i = 0; i < rays.size(); ++i) {
+            if (rays.state[i] != RayState::Firing) continue;
+            if (rays.playerDamagedThisFire[i]) continue; // already applied this cycle
 
-                    lastPlayerBulletTime = now;
+            const int ey = rays.y[i];
+            const int x0 = std::max(rays.x[i] - 1, 0), x1 = std::min(rays.x[i] + 1, arena.cols - 1);
+            bool hit = false;
+            for (int r = 0; r < static_cast<int>(shipMask.rows.size()) && !hit; ++r) {
+                if (!shipMask.rows[r]) continue;
+                const int py = player.y + r;
+                hit = py >= ey - 1 && py <= ey + 1;
+                //the ship row laid from column player.x crossing the three ray columns
+                for (int cx = x0; cx <= x1 && !hit; ++cx)
+                    hit = cx >= player.x && cx - player.x < 64 && ((shipMask.rows[r] >> (cx - player.x)) & 1);
+            }
+            if (hit) {
+                int newHp = player.hp - RayBatch::DAMAGE;
+                if (newHp < 0) newHp = 0;
+                player.hp = newHp;
+                rays.playerDamagedThisFire[i] = 1;
+                if (player.hp <= 0) {
+                    if (deathCause == DeathCause::None) deathCause = DeathCause::RayCross;
+                    running = false;
+                    break;
                 }
             }
-            frame++;
-            enemySpawnFrameCounter++;
-            basicSpawnFrameCounter++;
+        }
+    }
 
-            //+50 score every 50 frames survived
-            if (frame > 0 && (frame % 50) == 0) {
-                score += 50;
-            }
+    void chooseUpgrade() {
+        int choice = input->chooseUpgrade(3);
+        applyUpgrade(offeredUpgrades[choice]);
+        player.money = 0;
+        upgradePending = false;
+    }
 
-            //7.5% decrease every 100 frames after 1500 frames
-            const int basicBaseInterval = 83;
-            const int rayBaseInterval   = 100; //current baseline
+    void firePlayerBullets() {
+        //cooldown counted in frames so runs replay the same way regardless of wall clock
+        if ((frame - lastPlayerBulletFrame) * FRAME_MS < player.fireCooldownMs) return;
+        int bulletX = player.x + 1;
+        int bulletY = player.y;
+        int spd = (player.bulletSpeed < 0) ? -player.bulletSpeed : player.bulletSpeed;
 
-            int basicInterval = basicBaseInterval;
-            int rayInterval   = rayBaseInterval;
+        //in stream order, the first bulletStreams of them are fired
+        const std::pair<int, int> dirs[8] = {
+            { 0, player.bulletSpeed },
+            { -1, player.bulletSpeed }, //up left
+            { +1, player.bulletSpeed }, //up right
+            { -spd, 0 },                //left
+            { +spd, 0 },                //right
+            { -1, +spd },               //down left
+            { +1, +spd },               //down right
+            { 0, +spd },                //down
+        };
+        const int streams = std::max(1, std::min(8, player.bulletStreams));
 
-            int overFrames = frame - 1500;
-            if (overFrames > 0) {
-                int steps = overFrames / 100;
+        for (int i = 0; i < streams; ++i) {
+            const auto& d = dirs[i];
+            if (InArena(config.arena, bulletX, bulletY)) {
+                bullets.spawn(bulletX, bulletY, d.first, d.second, 'o', BulletOwner::Player);
+            }
+        }
 
+        lastPlayerBulletFrame = frame;
+    }
 
-                double b = static_cast<double>(basicInterval);
-                double r = static_cast<double>(rayInterval);
-                for (int i = 0; i < steps; ++i) {
-                    b *= 0.925;
-                    r *= 0.925;
-                }
-                basicInterval = static_cast<int>(b + 0.5);
-                rayInterval   = static_cast<int>(r + 0.5);
-                if (basicInterval < 1) basicInterval = 1;
-                if (rayInterval   < 1) rayInterval   = 1;
-            }
+    void advanceFrame() {
+        frame++;
 
-            if (basicSpawnFrameCounter >= basicInterval) {
-                static std::mt19937 rng(std::random_device{}());
-                std::uniform_int_distribution<int> xDist(0, GRID_COLS - 1);
-                std::uniform_int_distribution<int> yDist(0, 2);
-                int ex = xDist(rng);
-                int ey = yDist(rng);
-                enemies.push_back(std::make_unique<Enemy>(ex, ey));
-                basicSpawnFrameCounter = 0;
-            }
+        //+50 score every 50 frames survived
+        if (frame > 0 && (frame % 50) == 0) {
+            score += 50;
+        }
 
-            if (enemySpawnFrameCounter >= rayInterval) {
-                static std::mt19937 rngRay(std::random_device{}());
-                std::uniform_int_distribution<int> xDistRay(0, GRID_COLS - 1);
-                int ex = xDistRay(rngRay);
-                int ey = GRID_ROWS / 2;
-                enemies.push_back(std::make_unique<RayEnemy>(ex, ey));
-                enemySpawnFrameCounter = 0;
-            }
+        //spawns due this frame go out in a fixed order whatever order the wheel hands them over in
+        bool due[3] = {};
+        spawnTimers.advance(frame, [&](EnemyKind kind) { due[static_cast<int>(kind)] = true; });
 
-            //spawn boss at frame 2250 and every 500 frames after
-            if (frame >= 2250 && ((frame - 2250) % 500 == 0)) {
-                int bx = GRID_COLS / 2 - 1;
-                int by = 1;
-                enemies.push_back(std::make_unique<Boss>(bx, by));
-            }
+        if (due[static_cast<int>(EnemyKind::Basic)]) {
+            std::uniform_int_distribution<int> xDist(0, config.arena.cols - 1);
+            std::uniform_int_distribution<int> yDist(0, 2);
+            int ex = xDist(spawnRng);
+            int ey = yDist(spawnRng);
+            spawnEnemy(EnemyKind::Basic, ex, ey);
+            lastBasicSpawnFrame = frame;
+            scheduleSpawn(EnemyKind::Basic, basicRamp.nextAfter(frame));
+        }
+
+        if (due[static_cast<int>(EnemyKind::Ray)]) {
+            std::uniform_int_distribution<int> xDistRay(0, config.arena.cols - 1);
+            int ex = xDistRay(raySpawnRng);
+            int ey = config.arena.rows / 2;
+            spawnEnemy(EnemyKind::Ray, ex, ey);
+            lastRaySpawnFrame = frame;
+            scheduleSpawn(EnemyKind::Ray, rayRamp.nextAfter(frame));
+        }
 
-            std::this_thread::sleep_until(start + std::chrono::milliseconds(FRAME_MS));
+        if (due[static_cast<int>(EnemyKind::Boss)]) {
+            int bx = config.arena.cols / 2 - 1;
+            int by = 1;
+            spawnEnemy(EnemyKind::Boss, bx, by);
+            scheduleSpawn(EnemyKind::Boss, nextBossFrame(frame));
         }
+    }
+
+    void gameOver() {
         //on death prompt for username, store score, and show leaderboard
-        renderer.clearScreen();
+        input->restore();
+        renderer->clearScreen();
         std::cout << "Game Over! Survived " << frame << " frames.\n";
+        if (!bulletManager.lastError().empty()) std::cout << "Pattern stopped early: " << bulletManager.lastError() << "\n";
         std::cout << "Your score: " << score << "\n\n";
         std::cout << "Enter a username for the leaderboard: " << std::flush;
 
@@ -739,79 +4488,60 @@ while (std::cin.rdbuf()->in_avail() > 0) {
         if (username.size() > 24) username.resize(24);
         if (username.empty()) username = "Player";
 
-        //append score to highscores.txt
-        const char* highscoresPath = "highscores.txt";
-        {
-            std::ofstream appendFile(highscoresPath, std::ios::app);
-            if (appendFile) {
-                appendFile << score << '\t' << username << '\n';
-            } else {
-                std::cerr << "Warning: could not open highscores.txt for writing.\n";
-            }
+#if DEFFDRED_PROFILE
+        profiler.phases[static_cast<int>(Phase::Render)].merge(renderTimes);
+        if (!profiler.writeJson("frametimes.json") || !profiler.writeCsv("frametimes.csv")) {
+            std::cerr << "Warning: could not write frame time histograms.\n";
         }
-
-        // Load, sort, and display Top 10 x
-        std::vector<std::pair<int, std::string>> allScores;
-        {
-            std::ifstream in(highscoresPath);
-            std::string line;
-            while (std::getline(in, line)) {
-                if (line.empty()) continue;
-                size_t sep = line.find('\t');
-                if (sep == std::string::npos) continue;
-                std::string sPart = line.substr(0, sep);
-                std::string nPart = line.substr(sep + 1);
-                if (!nPart.empty() && nPart.back() == '\r') nPart.pop_back();
-
-                int sVal = 0;
-                try {
-                    sVal = std::stoi(sPart);
-                } catch (...) {
-                    continue;
-                }
-                allScores.emplace_back(sVal, nPart);
-            }
+#endif
+        //record the score, the leaderboard comes back with it
+        std::vector<ScoreEntry> topScores;
+        std::string why;
+        Leaderboard leaderboard("highscores.txt");
+        if (!leaderboard.record(score, username, topScores, why) || !why.empty()) {
+            std::cerr << "Warning: " << why << ".\n";
         }
 
-        //sort descending by score
-        std::sort(allScores.begin(), allScores.end(),
-            [](const std::pair<int, std::string>& a, const std::pair<int, std::string>& b) {
-                return a.first > b.first;
-            });
-
         //show leaderboard
-        renderer.clearScreen();
+        renderer->clearScreen();
         std::cout << "===== Leaderboard (Top 10) =====\n";
-        int topCount = static_cast<int>(allScores.size());
-        if (topCount > 10) topCount = 10;
-        for (int i = 0; i < topCount; ++i) {
-            std::cout << (i + 1) << ". " << allScores[i].second << " - " << allScores[i].first << "\n";
+        for (size_t i = 0; i < topScores.size(); ++i) {
+            std::cout << (i + 1) << ". " << topScores[i].name << " - " << topScores[i].score << "\n";
         }
         std::cout << "\nYour score: " << score << "\n";
     }
 
+    EnemyHandle spawnEnemy(EnemyKind kind, int x, int y) {
+        const EnemyHandle handle = enemies.spawn(kind, x, y, tick);
+        enemyGrid.insert(static_cast<int>(handle.slot), x, y, GetEnemyHitMask(kind));
+        const uint32_t index = enemies.slots[handle.slot].index;
+        enemyTimers.schedule(kind == EnemyKind::Ray ? enemies.rays.stateEndTick[index] : enemies.batch(kind).fireTick[index], handle);
+        return handle;
+    }
+
     void offerUpgrades() {
-        std::vector<UpgradeType> allUpgrades = {
+        UpgradeType allUpgrades[] = {
             UpgradeType::IncreaseHP, UpgradeType::AttackSpeed,
             UpgradeType::BulletSpeed, UpgradeType::Damage,
             UpgradeType::MoveSpeed, UpgradeType::BulletsAmount,
             UpgradeType::LifeSteal // NEW
         };
-        std::shuffle(allUpgrades.begin(), allUpgrades.end(), std::mt19937(std::random_device{}()));
-        offeredUpgrades.assign(allUpgrades.begin(), allUpgrades.begin() + 3);
+        std::shuffle(std::begin(allUpgrades), std::end(allUpgrades), upgradeRng);
+        offeredUpgrades.assign(allUpgrades, allUpgrades + 3);
         upgradePending = true;
     }
 
     void applyUpgrade(UpgradeType upg) {
+        const BalanceParams& balance = config.balance;
         switch (upg) {
         case UpgradeType::IncreaseHP:
-            player.maxHp += 5; player.hp += 5; break;
+            player.maxHp += balance.hpPerUpgrade; player.hp += balance.hpPerUpgrade; break;
         case UpgradeType::AttackSpeed:
-            player.fireCooldownMs = (player.fireCooldownMs * 0.8); break;
+            player.fireCooldownMs = static_cast<int>(player.fireCooldownMs * balance.fireCooldownFactor); break;
         case UpgradeType::BulletSpeed:
             player.bulletSpeed -= 1; break;
         case UpgradeType::Damage:
-            player.damage += 5; break;
+            player.damage += balance.damagePerUpgrade; break;
         case UpgradeType::MoveSpeed:
             player.moveSpeed += 1; break;
         case UpgradeType::BulletsAmount: {
@@ -819,14 +4549,857 @@ while (std::cin.rdbuf()->in_avail() > 0) {
             break;
         }
         case UpgradeType::LifeSteal:
-            player.lifeStealPercent += 5;
+            player.lifeStealPercent += balance.lifeStealPerUpgrade;
             break;
         }
     }
 };
 
-int main() {
+static std::vector<int> ParseIntList(const std::string& text) {
+    std::vector<int> values;
+    std::istringstream iss(text);
+    std::string item;
+    while (std::getline(iss, item, ',')) {
+        if (!item.empty()) values.push_back(std::stoi(item));
+    }
+    return values;
+}
+
+//ROWSxCOLS
+static bool ParseArena(const std::string& text, Arena& arena) {
+    const size_t x = text.find('x');
+    if (x == std::string::npos) return false;
+    try {
+        arena.rows = std::stoi(text.substr(0, x));
+        arena.cols = std::stoi(text.substr(x + 1));
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+    return arena.valid();
+}
+
+//times each phase of Game::step on synthetic worlds and writes the ns/frame of every phase as JSON
+class FrameBench {
+    struct Result {
+        const char* phase;
+        int bullets, enemies;
+        long iterations;
+        double nsPerFrame;
+        size_t bytes; //state size for the capture phases, 0 elsewhere
+    };
+    std::vector<Result> results;
+    std::mt19937 rng{ 20240601 };
+
+    static GameConfig benchConfig() {
+        GameConfig config;
+        config.headless = true;
+        config.seed = 1;
+        return config;
+    }
+
+    void fillBullets(BulletPool& bullets, int count) {
+        std::uniform_int_distribution<int> xDist(0, GRID_COLS - 1), yDist(0, GRID_ROWS - 1), vDist(-1, 1);
+        for (int i = 0; i < count; ++i) {
+            //a third each of player shots, enemy shots and boss shots
+            switch (i % 3) {
+            case 0: bullets.spawn(xDist(rng), yDist(rng), vDist(rng), -1, 'o', BulletOwner::Player); break;
+            case 1: bullets.spawn(xDist(rng), yDist(rng), vDist(rng), vDist(rng), '*', BulletOwner::Enemy); break;
+            default: bullets.spawn(xDist(rng), yDist(rng), 2 * vDist(rng), 2 * vDist(rng), 'O', BulletOwner::Enemy); break;
+            }
+        }
+    }
+
+    //enemies get enough hp to survive every iteration so a phase sees the same population each time
+    void fillEnemies(Game& game, int count) {
+        std::uniform_int_distribution<int> xDist(0, GRID_COLS - 1), yDist(0, GRID_ROWS - 1), timerDist(0, 60);
+        for (int i = 0; i < count; ++i) {
+            const EnemyKind kind = i % 10 == 9 ? EnemyKind::Boss : i % 3 == 2 ? EnemyKind::Ray : EnemyKind::Basic;
+            const int x = xDist(rng), y = yDist(rng);
+            const EnemyStore::Slot& ref = game.enemies.slots[game.spawnEnemy(kind, x, y).slot];
+            EnemyBatch& batch = game.enemies.batch(kind);
+            if (kind == EnemyKind::Ray) {
+                game.enemies.rays.state[ref.index] = static_cast<RayState>((i / 3) % 3);
+                game.enemies.rays.stateEndTick[ref.index] = game.tick + 1 + timerDist(rng);
+            } else {
+                batch.fireTick[ref.index] = game.tick + timerDist(rng);
+            }
+            batch.hp[ref.index] = 1 << 30;
+        }
+        game.rebuildTimers();
+    }
+
+    //runs setup untimed and body timed until enough time has been measured
+    template <typename Setup, typename Body>
+    void measure(const char* phase, int bullets, int enemies, Setup setup, Body body) {
+        const long maxIterations = 100000;
+        const double budgetNs = 2e7;
+        double totalNs = 0;
+        long iterations = 0;
+        while (iterations < 5 || (totalNs < budgetNs && iterations < maxIterations)) {
+            setup();
+            auto t0 = std::chrono::steady_clock::now();
+            body();
+            auto t1 = std::chrono::steady_clock::now();
+            totalNs += std::chrono::duration<double, std::nano>(t1 - t0).count();
+            ++iterations;
+        }
+        Result r{ phase, bullets, enemies, iterations, totalNs / iterations, 0 };
+        std::printf("%-22s %8d %8d %14.0f\n", r.phase, r.bullets, r.enemies, r.nsPerFrame);
+        results.push_back(r);
+    }
+
+    void benchBullets(int bulletCount) {
+        Game game(benchConfig());
+        BulletPool initial;
+        fillBullets(initial, bulletCount);
+        measure("bullet_update_cull", bulletCount, 0,
+            [&] { game.bullets = initial; },
+            [&] { game.updateBullets(); });
+        static const char* const kernelPhases[] = { "bullet_step_scalar", "bullet_step_ssse3", "bullet_step_avx2" };
+        for (SimdLevel level : { SimdLevel::Scalar, SimdLevel::Ssse3, SimdLevel::Avx2 }) {
+            const BulletStepFn kernel = GetBulletStep(level);
+            if (!kernel) continue;
+            measure(kernelPhases[static_cast<int>(level)], bulletCount, 0,
+                [&] { game.bullets = initial; },
+                [&] { game.bullets.step(kernel); });
+        }
+
+        BulletManager manager;
+        std::uniform_int_distribution<int> xDist(0, GRID_COLS - 1), vDist(-1, 1);
+        for (int i = 0; i < bulletCount; ++i)
+            manager.spawns.push_back(BulletSpawn{ 0, xDist(rng), 0, vDist(rng), 1 });
+        measure("pattern_spawn", bulletCount, 0,
+            [&] { manager.nextSpawn = 0; game.bullets.clear(); },
+            [&] { manager.spawnBullets(0, game.bullets, 0, 0); });
+    }
+
+    void benchEnemies(int enemyCount) {
+        Game game(benchConfig());
+        fillEnemies(game, enemyCount);
+        measure("enemy_update", 0, enemyCount,
+            [&] { game.bullets.clear(); },
+            [&] { game.updateEnemies(); });
+        const unsigned threads = std::thread::hardware_concurrency();
+        if (threads > 1) {
+            game.aiWorkers = std::make_unique<ParallelFor>(threads);
+            measure("enemy_update_mt", 0, enemyCount,
+                [&] { game.bullets.clear(); },
+                [&] { game.updateEnemies(); });
+            game.aiWorkers.reset();
+        }
+        measure("ray_checks", 0, enemyCount,
+            [&] { game.player.hp = game.player.maxHp; game.running = true; },
+            [&] { game.checkRays(ClassicArena()); });
+    }
+
+    void benchWorld(int bulletCount, int enemyCount) {
+        Game game(benchConfig());
+        fillEnemies(game, enemyCount);
+        BulletPool initial;
+        fillBullets(initial, bulletCount);
+        measure("player_bullet_hits", bulletCount, enemyCount,
+            [&] { game.bullets = initial; },
+            [&] { game.hitEnemiesWithPlayerBullets(ClassicArena()); });
+
+        //what one rewind capture and restore costs against REWIND_FRAME_BUDGET
+        game.bullets = initial;
+        std::vector<unsigned char> state(size_t(1) << 24);
+        size_t stateBytes = 0;
+        measure("state_capture", bulletCount, enemyCount,
+            [] {},
+            [&] { stateBytes = game.saveState(state.data(), state.size()); });
+        results.back().bytes = stateBytes;
+        measure("state_restore", bulletCount, enemyCount,
+            [] {},
+            [&] { game.loadState(state.data(), stateBytes); });
+        results.back().bytes = stateBytes;
+        std::printf("%-22s %8d %8d %14zu bytes, %s the %zu byte budget\n", "state_size", bulletCount, enemyCount,
+            stateBytes, stateBytes <= REWIND_FRAME_BUDGET ? "within" : "over", REWIND_FRAME_BUDGET);
+
+        //alternate between two consecutive frames so every draw has a real diff to send
+        BulletPool next = initial;
+        next.step();
+        Renderer renderer;
+        std::string sink;
+        renderer.setSink(&sink);
+        WorldSnapshot frames[2];
+        game.capture(frames[0]);
+        game.bullets = next;
+        game.capture(frames[1]);
+        long drawn = 0;
+        measure("render", bulletCount, enemyCount,
+            [&] { sink.clear(); },
+            [&] { renderer.draw(frames[drawn++ % 2]); });
+    }
+
+    bool writeJson(const std::string& path) const {
+        std::ofstream out(path);
+        if (!out) return false;
+        out << "{\n  \"frame_ms\": " << FRAME_MS << ",\n  \"grid\": [" << GRID_ROWS << ", " << GRID_COLS << "],\n  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const Result& r = results[i];
+            out << "    {\"phase\": \"" << r.phase << "\", \"bullets\": " << r.bullets << ", \"enemies\": " << r.enemies
+                << ", \"iterations\": " << r.iterations << ", \"ns_per_frame\": " << r.nsPerFrame;
+            if (r.bytes) out << ", \"state_bytes\": " << r.bytes;
+            out << "}"
+                << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+        return true;
+    }
+
+public:
+    int run(const std::vector<int>& bulletCounts, const std::vector<int>& enemyCounts, const std::string& jsonPath) {
+        std::printf("%-22s %8s %8s %14s\n", "phase", "bullets", "enemies", "ns/frame");
+        for (int b : bulletCounts) benchBullets(b);
+        for (int e : enemyCounts) benchEnemies(e);
+        for (int e : enemyCounts) {
+            for (int b : bulletCounts) benchWorld(b, e);
+        }
+        if (!writeJson(jsonPath)) {
+            std::cerr << "Could not write " << jsonPath << "\n";
+            return 1;
+        }
+        std::cout << "Wrote " << jsonPath << "\n";
+        return 0;
+    }
+};
+
+//times the old enemy x bullet x shape cell scan against EnemyGrid lookups on synthetic arenas
+//so the crossover between the two can be read off for each population size
+static int runCollisionBenchmark() {
+    const int enemyCounts[] = { 1, 10, 100, 1000 };
+    const int bulletCounts[] = { 10, 100, 1000, 10000 };
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<int> xDist(0, GRID_COLS - 1);
+    std::uniform_int_distribution<int> yDist(0, GRID_ROWS - 1);
+    std::uniform_int_distribution<int> stepDist(-1, 1);
+    volatile long long sink = 0;
+
+    std::cout << "enemies bullets  scan_ns/frame  grid_ns/frame  speedup\n";
+    for (int enemyCount : enemyCounts) {
+        for (int bulletCount : bulletCounts) {
+            struct Placed {
+                int x, y;
+                const std::vector<std::string>& shape;
+                const ShapeMask& hitMask;
+            };
+            std::vector<Placed> enemies;
+            for (int i = 0; i < enemyCount; ++i) {
+                const EnemyKind kind = i % 10 == 9 ? EnemyKind::Boss : i % 3 == 2 ? EnemyKind::Ray : EnemyKind::Basic;
+                enemies.push_back(Placed{ xDist(rng), yDist(rng), GetEnemyShape(kind), GetEnemyHitMask(kind) });
+            }
+            BulletPool bullets;
+            for (int i = 0; i < bulletCount; ++i)
+                bullets.spawn(xDist(rng), yDist(rng), 0, -1, 'o', BulletOwner::Player);
+
+            //enemies only step every third frame, so move a third of them per frame
+            auto wander = [&](int frame) {
+                for (size_t i = frame % 3; i < enemies.size(); i += 3) {
+                    Placed& e = enemies[i];
+                    e.x = std::min(GRID_COLS - 1, std::max(0, e.x + stepDist(rng)));
+                    e.y = std::min(GRID_ROWS - 1, std::max(0, e.y + stepDist(rng)));
+                }
+            };
+
+            const int frames = std::max(3, 2000000 / (enemyCount * bulletCount));
+
+            auto t0 = std::chrono::steady_clock::now();
+            for (int f = 0; f < frames; ++f) {
+                wander(f);
+                long long hits = 0;
+                for (const Placed& e : enemies) {
+                    for (size_t bi = 0; bi < bullets.size(); ++bi) {
+                        const int bx = bullets.x[bi], by = bullets.y[bi];
+                        bool hit = false;
+                        for (int sy = 0; sy < static_cast<int>(e.shape.size()) && !hit; ++sy) {
+                            for (int sx = 0; sx < static_cast<int>(e.shape[sy].size()) && !hit; ++sx) {
+                                if (e.shape[sy][sx] == ' ') continue;
+                                const int ex = e.x + sx, ey = e.y + sy;
+                                if (std::abs(bx - ex) + std::abs(by - ey) <= 1) hit = true;
+                            }
+                        }
+                        hits += hit;
+                    }
+                }
+                sink = sink + hits;
+            }
+            auto t1 = std::chrono::steady_clock::now();
+
+            EnemyGrid grid{ Arena() };
+            for (size_t i = 0; i < enemies.size(); ++i)
+                grid.insert(static_cast<int>(i), enemies[i].x, enemies[i].y, enemies[i].hitMask);
+            auto t2 = std::chrono::steady_clock::now();
+            for (int f = 0; f < frames; ++f) {
+                wander(f);
+                for (size_t i = 0; i < enemies.size(); ++i)
+                    grid.sync(static_cast<int>(i), enemies[i].x, enemies[i].y, enemies[i].hitMask);
+                long long hits = 0;
+                for (size_t bi = 0; bi < bullets.size(); ++bi)
+                    hits += static_cast<long long>(grid.at(bullets.x[bi], bullets.y[bi]).size());
+                sink = sink + hits;
+            }
+            auto t3 = std::chrono::steady_clock::now();
+
+            const double scanNs = std::chrono::duration<double, std::nano>(t1 - t0).count() / frames;
+            const double gridNs = std::chrono::duration<double, std::nano>(t3 - t2).count() / frames;
+            std::printf("%7d %7d %14.0f %14.0f %8.2fx\n", enemyCount, bulletCount, scanNs, gridNs, scanNs / gridNs);
+        }
+    }
+    return 0;
+}
+
+//fixed workers, each with its own deque: a worker runs its newest task first and, once its deque
+//is empty, steals the oldest task from another worker
+class WorkStealingPool {
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> queued{ 0 };  //waiting in a deque
+    std::atomic<size_t> pending{ 0 }; //submitted and not finished
+    bool stopping = false;            //guarded by idleMutex
+    std::mutex idleMutex;
+    std::condition_variable idleWake, doneWake;
+    size_t nextQueue = 0;
+
+    bool tryTake(size_t self, std::function<void()>& task) {
+        {
+            Queue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                queued--;
+                return true;
+            }
+        }
+        for (size_t k = 1; k < queues.size(); ++k) {
+            Queue& victim = *queues[(self + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(size_t self) {
+        std::function<void()> task;
+        for (;;) {
+            if (tryTake(self, task)) {
+                task();
+                task = nullptr;
+                if (--pending == 0) {
+                    std::lock_guard<std::mutex> lock(idleMutex);
+                    doneWake.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(idleMutex);
+            idleWake.wait(lock, [&] { return stopping || queued > 0; });
+            if (stopping && queued == 0) return;
+        }
+    }
+
+public:
+    explicit WorkStealingPool(unsigned threads) {
+        if (threads == 0) threads = 1;
+        for (unsigned i = 0; i < threads; ++i) queues.push_back(std::make_unique<Queue>());
+        for (unsigned i = 0; i < threads; ++i) workers.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            stopping = true;
+        }
+        idleWake.notify_all();
+        for (std::thread& t : workers) t.join();
+    }
+
+    //deals tasks round robin over the worker deques
+    void submit(std::function<void()> task) {
+        Queue& q = *queues[nextQueue++ % queues.size()];
+        pending++;
+        {
+            std::lock_guard<std::mutex> lock(q.mutex);
+            q.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            queued++;
+        }
+        idleWake.notify_one();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(idleMutex);
+        doneWake.wait(lock, [&] { return pending == 0; });
+    }
+};
+
+struct BatchOptions {
+    int games = 1000;
+    unsigned threads = 0;        //0 uses every hardware thread
+    std::string jsonPath;        //empty skips the JSON report
+};
+
+template <typename T>
+static T Percentile(std::vector<T> values, double p) {
+    if (values.empty()) return T();
+    const size_t k = std::min(values.size() - 1, static_cast<size_t>(p * values.size()));
+    std::nth_element(values.begin(), values.begin() + k, values.end());
+    return values[k];
+}
+
+//plays games seeds config.seed, config.seed + 1, ... headless on a work stealing pool, every game
+//owning all of its state, then reports survival, score and death causes
+static int runBatch(GameConfig config, const BatchOptions& options) {
+    config.headless = true;
+    if (!config.patternFile.empty()) {
+        //check the pattern once rather than have every game complain about it
+        try {
+            BulletManager probe;
+            probe.loadPattern(config.patternFile);
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Error loading pattern: " << e.what() << "\nBatch runs with an empty level.\n";
+            config.patternFile.clear();
+        }
+    }
+    if (!config.inputScript.empty()) {
+        ScriptedInput check(config.inputScript); //throws now instead of in every worker
+    }
+
+    const unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<RunResult> results(options.games);
+    std::atomic<int> failed{ 0 };
+    const auto t0 = std::chrono::steady_clock::now();
+    {
+        WorkStealingPool pool(threads);
+        for (int i = 0; i < options.games; ++i) {
+            pool.submit([&, i] {
+                GameConfig gameConfig = config;
+                gameConfig.seed = config.seed + static_cast<unsigned int>(i);
+                try {
+                    results[i] = Game(gameConfig).simulate();
+                }
+                catch (const std::exception&) {
+                    results[i].seed = gameConfig.seed;
+                    failed++;
+                }
+            });
+        }
+        pool.wait();
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    std::vector<int> frames, scores;
+    int causes[static_cast<int>(DeathCause::Count)] = {};
+    double frameSum = 0, scoreSum = 0;
+    for (const RunResult& r : results) {
+        frames.push_back(r.frames);
+        scores.push_back(r.score);
+        frameSum += r.frames;
+        scoreSum += r.score;
+        causes[static_cast<int>(r.cause)]++;
+    }
+    const double n = std::max(1, options.games);
+    std::printf("games=%d threads=%u seconds=%.3f games/s=%.1f failed=%d\n", options.games, threads, seconds,
+        seconds > 0 ? options.games / seconds : 0.0, failed.load());
+    std::printf("frames  mean %9.1f  p10 %7d  p50 %7d  p90 %7d  max %7d\n", frameSum / n,
+        Percentile(frames, 0.1), Percentile(frames, 0.5), Percentile(frames, 0.9), Percentile(frames, 1.0));
+    std::printf("score   mean %9.1f  p10 %7d  p50 %7d  p90 %7d  max %7d\n", scoreSum / n,
+        Percentile(scores, 0.1), Percentile(scores, 0.5), Percentile(scores, 0.9), Percentile(scores, 1.0));
+    std::printf("ended  ");
+    for (int c = 0; c < static_cast<int>(DeathCause::Count); ++c) {
+        const char* name = c == static_cast<int>(DeathCause::None) ? "survived" : GetDeathCauseName(static_cast<DeathCause>(c));
+        std::printf(" %s %d (%.1f%%)", name, causes[c], 100.0 * causes[c] / n);
+    }
+    std::printf("\n");
+
+    if (!options.jsonPath.empty()) {
+        std::ofstream out(options.jsonPath);
+        if (!out) {
+            std::cerr << "Could not write " << options.jsonPath << "\n";
+            return 1;
+        }
+        out << "{\n  \"games\": " << options.games << ",\n  \"threads\": " << threads << ",\n  \"seconds\": " << seconds
+            << ",\n  \"frames\": {\"mean\": " << frameSum / n << ", \"p50\": " << Percentile(frames, 0.5)
+            << ", \"p90\": " << Percentile(frames, 0.9) << ", \"max\": " << Percentile(frames, 1.0) << "}"
+            << ",\n  \"score\": {\"mean\": " << scoreSum / n << ", \"p50\": " << Percentile(scores, 0.5)
+            << ", \"p90\": " << Percentile(scores, 0.9) << ", \"max\": " << Percentile(scores, 1.0) << "}"
+            << ",\n  \"causes\": {";
+        for (int c = 0; c < static_cast<int>(DeathCause::Count); ++c) {
+            out << (c ? ", " : "") << "\"" << (c == 0 ? "survived" : GetDeathCauseName(static_cast<DeathCause>(c)))
+                << "\": " << causes[c];
+        }
+        out << "},\n  \"runs\": [\n";
+        for (size_t i = 0; i < results.size(); ++i) {
+            const RunResult& r = results[i];
+            out << "    {\"seed\": " << r.seed << ", \"frames\": " << r.frames << ", \"score\": " << r.score
+                << ", \"cause\": \"" << (r.cause == DeathCause::None ? "survived" : GetDeathCauseName(r.cause)) << "\"}"
+                << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+    }
+    return failed ? 1 : 0;
+}
+
+//the game the self checks soak: the random policy on one seed, headless with no frame limit, and a
+//player that survives anything so the world keeps filling up
+class SoakGame {
+public:
     Game game;
-    game.run("pattern.txt");
+
+    static GameConfig Config(const GameConfig& base, unsigned int seed) {
+        GameConfig config = base;
+        config.headless = true;
+        config.seed = seed;
+        config.policy = InputPolicy::Random;
+        config.inputScript.clear();
+        config.maxFrames = 0;
+        return config;
+    }
+    explicit SoakGame(const GameConfig& config) : game(config) {
+        game.start();
+        game.player.maxHp = game.player.hp = 1 << 28;
+    }
+    //one frame on, or rewindFrames back when that is not 0
+    void step(int rewindFrames = 0) {
+        if (rewindFrames) game.rewind(rewindFrames);
+        else game.step();
+        if (!game.running) {
+            //rays kill outright, carry on as if they had not
+            game.player.hp = game.player.maxHp;
+            game.running = true;
+        }
+    }
+};
+
+//soaks games that cannot be lost under random input, drawing every frame into memory, and fails if
+//any frame after the warm up allocates; needs a DEFFDRED_COUNT_ALLOCS=1 build
+class AllocCheck {
+public:
+    static int run(const GameConfig& base) {
+#if !DEFFDRED_COUNT_ALLOCS
+        (void)base;
+        std::cerr << "--check-alloc needs a build with -DDEFFDRED_COUNT_ALLOCS=1\n";
+        return 2;
+#else
+        const int warmupFrames = 300, checkedFrames = 3000;
+        int failed = 0;
+        for (unsigned int seed = 1; seed <= 4; ++seed) {
+            GameConfig config = SoakGame::Config(base, seed);
+            config.rewind = true;
+            SoakGame soak(config);
+            Game& game = soak.game;
+            Renderer renderer;
+            std::string sink;
+            sink.reserve(size_t(1) << 16);
+            renderer.setSink(&sink);
+            WorldSnapshot world;
+            unsigned long long allocs = 0, allocatingFrames = 0;
+            int firstFrame = -1;
+            for (int steps = 1; game.frame < warmupFrames + checkedFrames; ++steps) {
+                const bool counted = game.frame >= warmupFrames;
+                const unsigned long long before = g_allocCount.load();
+                soak.step(steps % 500 == 0 ? 30 : 0); //restores reuse the capacity already there
+                game.capture(world);
+                renderer.draw(world);
+                sink.clear();
+                const unsigned long long made = g_allocCount.load() - before;
+                if (counted && made) {
+                    allocs += made;
+                    allocatingFrames++;
+                    if (firstFrame < 0) firstFrame = game.frame;
+                }
+            }
+            std::printf("seed %u: %d frames after %d warm up, %llu allocations in %llu frames%s, %zu bullets %zu enemies\n",
+                seed, checkedFrames, warmupFrames, allocs, allocatingFrames,
+                firstFrame < 0 ? "" : (" from frame " + std::to_string(firstFrame)).c_str(),
+                game.bullets.size(), game.enemies.alive());
+            if (allocs) failed++;
+        }
+        std::cout << (failed ? "FAIL" : "ok") << "\n";
+        return failed ? 1 : 0;
+#endif
+    }
+};
+
+//plays each seed twice in lock step, once with a serial AI pass and once with it split over threads
+//in small chunks, under spawn rates that fill the arena; every frame's world checksum must match
+class ParallelAiCheck {
+public:
+    static int run(const GameConfig& base) {
+        const int frames = 2000;
+        const unsigned threads = std::max(4u, std::thread::hardware_concurrency());
+        int failed = 0;
+        for (unsigned int seed = 1; seed <= 4; ++seed) {
+            GameConfig config = SoakGame::Config(base, seed);
+            config.rewind = false;
+            config.balance.basicSpawnInterval = 4;
+            config.balance.raySpawnInterval = 6;
+            config.aiThreads = 1;
+            SoakGame serial(config);
+            config.aiThreads = threads;
+            SoakGame parallel(config);
+            parallel.game.aiGrain = 8;
+            int mismatch = -1;
+            while (serial.game.frame < frames && mismatch < 0) {
+                serial.step();
+                parallel.step();
+                if (serial.game.worldChecksum() != parallel.game.worldChecksum()) mismatch = serial.game.frame;
+            }
+            std::printf("seed %u: %d frames on %u threads, %zu enemies at the end, %s\n", seed, serial.game.frame, threads,
+                serial.game.enemies.alive(), mismatch < 0 ? "identical" : ("differs from frame " + std::to_string(mismatch)).c_str());
+            if (mismatch >= 0) failed++;
+        }
+        std::cout << (failed ? "FAIL" : "ok") << "\n";
+        return failed ? 1 : 0;
+    }
+};
+
+//runs every bullet step kernel this cpu supports against the scalar one on random pools, including
+//sizes that leave partial blocks and positions on and just past every edge, in the classic arena
+//and a bigger one
+static int runSimdCheck() {
+    std::mt19937 rng(99);
+    std::uniform_int_distribution<int> vDist(-4, 4), byteDist(0, 255);
+    std::vector<size_t> sizes;
+    for (size_t n = 0; n <= 40; ++n) sizes.push_back(n);
+    sizes.push_back(1000);
+    sizes.push_back(100003);
+    int failures = 0;
+    for (SimdLevel level : { SimdLevel::Ssse3, SimdLevel::Avx2 }) {
+        const BulletStepFn kernel = GetBulletStep(level);
+        if (!kernel) {
+            std::printf("%-7s not supported here, skipped\n", GetSimdName(level));
+            continue;
+        }
+        int cases = 0, bad = 0;
+        for (const Arena& arena : { Arena(), Arena{ 300, 1000 } }) {
+            std::uniform_int_distribution<int> xDist(-3, arena.cols + 2), yDist(-3, arena.rows + 2);
+            for (size_t n : sizes) {
+                for (int round = 0; round < 8; ++round) {
+                    BulletPool pool;
+                    for (size_t i = 0; i < n; ++i) {
+                        pool.spawn(xDist(rng), yDist(rng), vDist(rng), vDist(rng), static_cast<char>(byteDist(rng)),
+                            byteDist(rng) & 1 ? BulletOwner::Player : BulletOwner::Enemy);
+                    }
+                    BulletPool expected = pool;
+                    expected.step(GetBulletStep(SimdLevel::Scalar), arena);
+                    pool.step(kernel, arena);
+                    ++cases;
+                    if (pool.x != expected.x || pool.y != expected.y || pool.dx != expected.dx || pool.dy != expected.dy
+                        || pool.symbol != expected.symbol || pool.owner != expected.owner) {
+                        if (bad++ == 0) std::printf("%-7s mismatch at %zu bullets in %dx%d\n", GetSimdName(level), n,
+                            arena.rows, arena.cols);
+                    }
+                }
+            }
+        }
+        std::printf("%-7s %d/%d pools match scalar\n", GetSimdName(level), cases - bad, cases);
+        failures += bad;
+    }
+    return failures ? 1 : 0;
+}
+
+static volatile std::sig_atomic_t g_spectateStop = 0;
+static void onSpectateInterrupt(int) { g_spectateStop = 1; }
+
+//draws the frames a game broadcasts until it ends or Ctrl-C, without ever holding the game up
+static int runSpectator(const std::string& name, bool repeatRuns) {
+    FrameBroadcast feed;
+    if (!feed.attach(name)) {
+        std::cerr << "No game is broadcasting as " << name << "\n";
+        return 1;
+    }
+    if (feed.rows() != Renderer::ROWS || feed.cols() != Renderer::COLS) {
+        std::cerr << "Broadcast " << name << " is " << feed.rows() << "x" << feed.cols() << " cells, this build draws "
+                  << Renderer::ROWS << "x" << Renderer::COLS << "\n";
+        return 1;
+    }
+    std::signal(SIGINT, onSpectateInterrupt);
+    Renderer renderer(repeatRuns);
+    std::vector<char> cells(Renderer::ROWS * Renderer::COLS, ' ');
+    BroadcastHud hud = {};
+    bool seen = false;
+    while (!g_spectateStop && !feed.closed()) {
+        if (feed.read(cells.data(), hud)) {
+            renderer.drawCells(cells.data());
+            seen = true;
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(FRAME_MS / 4));
+        }
+    }
+    renderer.clearScreen();
+    std::cout << (feed.closed() ? "Broadcast ended" : "Stopped watching");
+    if (seen) std::cout << " at frame " << hud.frame << ", score " << hud.score << ", hp " << hud.hp << "/" << hud.maxHp;
+    std::cout << "\n";
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    GameConfig config;
+    bool seeded = false;
+    bool bench = false;
+    std::vector<int> benchBullets = { 10, 1000, 10000, 100000 };
+    std::vector<int> benchEnemies = { 10, 100, 1000 };
+    std::string benchJson = "bench.json";
+    bool batch = false;
+    bool checkAlloc = false;
+    bool checkParallelAi = false;
+    BatchOptions batchOptions;
+    std::string replayFile;
+    int seekFrame = -1;
+    int rewindOption = -1; //-1 on when playing in the terminal
+    std::string spectateName;
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--bench-collision") return runCollisionBenchmark();
+        else if (arg == "--check-simd") return runSimdCheck();
+        else if (arg == "--check-alloc") checkAlloc = true;
+        else if (arg == "--check-parallel-ai") checkParallelAi = true;
+        else if (arg == "--spectate" && hasValue) spectateName = argv[++i];
+        else if (arg == "--broadcast" && hasValue) config.broadcastName = argv[++i];
+        else if (arg == "--arena" && hasValue) {
+            if (!ParseArena(argv[++i], config.arena)) {
+                std::cerr << "Arena must be ROWSxCOLS from " << GRID_ROWS << "x" << GRID_COLS << " to "
+                          << MAX_ARENA_SIDE << "x" << MAX_ARENA_SIDE << "\n";
+                return 1;
+            }
+        }
+        else if (arg == "--ai-threads" && hasValue) config.aiThreads = std::max(1u, static_cast<unsigned>(std::stoul(argv[++i])));
+        else if (arg == "--bench") bench = true;
+        else if (arg == "--bench-bullets" && hasValue) benchBullets = ParseIntList(argv[++i]);
+        else if (arg == "--bench-enemies" && hasValue) benchEnemies = ParseIntList(argv[++i]);
+        else if (arg == "--bench-json" && hasValue) benchJson = argv[++i];
+        else if (arg == "--convert-pattern" && i + 2 < argc) {
+            bool delta = i + 3 < argc && std::string(argv[i + 3]) == "--delta";
+            try {
+                BulletManager::convert(argv[i + 1], argv[i + 2], delta);
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Conversion failed: " << e.what() << "\n";
+                return 1;
+            }
+            return 0;
+        }
+        else if (arg == "--validate-pattern" && hasValue) {
+            std::string why;
+            if (!BulletManager::validate(argv[i + 1], why)) {
+                std::cerr << argv[i + 1] << ": " << why << "\n";
+                return 1;
+            }
+            std::cout << argv[i + 1] << ": ok\n";
+            return 0;
+        }
+        else if (arg == "--headless") config.headless = true;
+        else if (arg == "--overlay") config.overlay = true;
+        else if (arg == "--no-repeat") config.repeatRuns = false;
+        else if (arg == "--seed" && hasValue) { config.seed = static_cast<unsigned int>(std::stoul(argv[++i])); seeded = true; }
+        else if (arg == "--frames" && hasValue) config.maxFrames = std::stoi(argv[++i]);
+        else if (arg == "--pattern" && hasValue) config.patternFile = argv[++i];
+        else if (arg == "--script" && hasValue) config.inputScript = argv[++i];
+        else if (arg == "--record" && hasValue) config.recordFile = argv[++i];
+        else if (arg == "--replay" && hasValue) replayFile = argv[++i];
+        else if (arg == "--seek" && hasValue) seekFrame = std::stoi(argv[++i]);
+        else if (arg == "--rewind") rewindOption = 1;
+        else if (arg == "--no-rewind") rewindOption = 0;
+        else if (arg == "--checksum-every" && hasValue) config.checksumInterval = std::stoi(argv[++i]);
+        else if (arg == "--batch" && hasValue) { batch = true; batchOptions.games = std::stoi(argv[++i]); }
+        else if (arg == "--threads" && hasValue) batchOptions.threads = static_cast<unsigned>(std::stoul(argv[++i]));
+        else if (arg == "--batch-json" && hasValue) batchOptions.jsonPath = argv[++i];
+        else if (arg == "--policy" && hasValue) {
+            const std::string policy = argv[++i];
+            if (policy == "idle") config.policy = InputPolicy::Idle;
+            else if (policy == "random") config.policy = InputPolicy::Random;
+            else if (policy == "autopilot") config.policy = InputPolicy::Autopilot;
+            else {
+                std::cerr << "Unknown policy: " << policy << "\n";
+                return 1;
+            }
+        }
+        else if (arg == "--balance" && hasValue) {
+            try {
+                config.balance.load(argv[++i]);
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Error: " << e.what() << "\n";
+                return 1;
+            }
+        }
+        else {
+            std::cerr << "Unknown option: " << arg << "\n";
+            return 1;
+        }
+    }
+    if (!spectateName.empty()) return runSpectator(spectateName, config.repeatRuns);
+    if (bench) return FrameBench().run(benchBullets, benchEnemies, benchJson);
+    if (checkAlloc) return AllocCheck::run(config);
+    if (checkParallelAi) return ParallelAiCheck::run(config);
+    if (!replayFile.empty()) {
+        //the recording decides everything the simulation depends on
+        try {
+            auto replay = std::make_shared<Replay>(Replay::load(replayFile));
+            config.seed = replay->seed;
+            config.patternFile = replay->patternFile;
+            config.balance = BalanceParams();
+            std::istringstream balance(replay->balance);
+            config.balance.read(balance);
+            config.checksumInterval = replay->checksumInterval;
+            config.arena = Arena{ replay->arenaRows, replay->arenaCols };
+            config.inputScript.clear();
+            config.policy = InputPolicy::Idle;
+            config.maxFrames = 0;
+            config.headless = seekFrame < 0;
+            //rewinds are replayed too, which needs the same history they were taken from
+            config.rewind = std::find_if(replay->keys.begin(), replay->keys.end(),
+                [](KeyMask k) { return (k & KeyRewind) != 0; }) != replay->keys.end();
+            if (Replay::HashFile(config.patternFile) != replay->patternHash)
+                std::cerr << "Warning: " << config.patternFile << " differs from the recorded run, playback may desync.\n";
+            config.replay = replay;
+            Game game(config);
+            if (seekFrame < 0) game.runHeadless();
+            else game.watch(seekFrame);
+            return game.replayMatched() ? 0 : 1;
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+    if (!seeded) config.seed = std::random_device{}();
+    config.rewind = rewindOption < 0 ? !config.headless && !batch : rewindOption == 1;
+    if ((config.headless || batch) && config.maxFrames == 0) config.maxFrames = 100000;
+    if (batch) {
+        try {
+            return runBatch(config, batchOptions);
+        }
+        catch (const std::exception& e) {
+            std::cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+
+    try {
+        Game game(config);
+        if (config.headless) game.runHeadless();
+        else game.run();
+    }
+    catch (const std::exception& e) {
+        std::cerr << "Error: " << e.what() << "\n";
+        return 1;
+    }
     return 0;
-}
\ No newline at end of file
+}